@@ -8,8 +8,274 @@
 #include <ranges>
 #include <mutex>
 #include <thread>
+#include <atomic>
+#include <array>
+#include <cstdio>
+#include <cstdint>
+#include <sstream>
+#include <chrono>
+#include <span>
+#include <optional>
+#include <string_view>
+#include <type_traits>
+#include <shared_mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <functional>
+#include <condition_variable>
+#include <bit>
+#include <random>
+#include <iomanip>
+#include <new>
+#include <variant>
+#include <deque>
+#include <csignal>
+#include <cstring>
+#include <cerrno>
+#include <limits>
+#include <coroutine>
+#include <exception>
+#include <tuple>
+#include <charconv>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
 
-std::mutex coutMutex;
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+class LogSink {
+public:
+    enum class DropPolicy { DropNewest, Block };
+
+    // Console records are the program's output (menu, prompts, command results): they always go to
+    // stdout and are never dropped. Diagnostic records go to the log file when one is open and are
+    // subject to the drop policy.
+    enum class Channel { Console, Diagnostic };
+
+private:
+    static constexpr std::size_t BufferCapacity = 4096;
+
+    struct Record {
+        std::uint64_t seq = 0;
+        Channel channel = Channel::Console;
+        std::string text;
+    };
+
+    // Single-producer/single-consumer ring owned by one writing thread and drained by the writer thread.
+    struct ThreadBuffer {
+        std::array<Record, BufferCapacity> slots;
+        std::atomic<std::size_t> head{0};
+        std::atomic<std::size_t> tail{0};
+    };
+
+    std::mutex registryMutex;
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    std::atomic<std::FILE*> output{stdout};
+    std::atomic<DropPolicy> dropPolicy{DropPolicy::DropNewest};
+    std::atomic<std::uint64_t> nextSeq{0};
+    // Every record with a lower sequence number has been written out.
+    std::atomic<std::uint64_t> writtenSeq{0};
+    std::atomic<std::uint64_t> droppedRecords{0};
+    std::atomic<std::uint64_t> pending{0};
+    std::atomic<std::uint64_t> cycles{0};
+    std::atomic<bool> running{true};
+    std::thread writer;
+
+    LogSink() : writer([this] { run(); }) {}
+
+    ThreadBuffer& localBuffer() {
+        thread_local std::shared_ptr<ThreadBuffer> local;
+        if (!local) {
+            local = std::make_shared<ThreadBuffer>();
+            std::lock_guard<std::mutex> lock(registryMutex);
+            buffers.push_back(local);
+        }
+        return *local;
+    }
+
+    void wake() {
+        pending.fetch_add(1, std::memory_order_release);
+        pending.notify_one();
+    }
+
+    void waitForCycle(std::uint64_t target) {
+        for (auto seen = cycles.load(std::memory_order_acquire); seen < target;
+             seen = cycles.load(std::memory_order_acquire)) {
+            cycles.wait(seen, std::memory_order_acquire);
+        }
+    }
+
+    // Appends every published record to `batch`; returns whether there were any.
+    bool drainInto(std::vector<Record>& batch) {
+        const std::size_t held = batch.size();
+        std::vector<std::shared_ptr<ThreadBuffer>> snapshot;
+        {
+            std::lock_guard<std::mutex> lock(registryMutex);
+            std::erase_if(buffers, [](const std::shared_ptr<ThreadBuffer>& buffer) {
+                return buffer.use_count() == 1 &&
+                       buffer->head.load(std::memory_order_relaxed) == buffer->tail.load(std::memory_order_acquire);
+            });
+            snapshot = buffers;
+        }
+        for (const auto& buffer : snapshot) {
+            std::size_t head = buffer->head.load(std::memory_order_relaxed);
+            const std::size_t tail = buffer->tail.load(std::memory_order_acquire);
+            for (; head != tail; ++head) {
+                batch.push_back(std::move(buffer->slots[head % BufferCapacity]));
+            }
+            buffer->head.store(head, std::memory_order_release);
+        }
+        return batch.size() != held;
+    }
+
+    // A producer publishes its record after taking a sequence number, so a batch can hold a record
+    // whose predecessor is still being published by another thread. Only the gap-free prefix of the
+    // batch is written; the rest waits for the next cycle.
+    void run() {
+        std::vector<Record> batch;
+        std::uint64_t expected = 0;
+        while (true) {
+            const auto seen = pending.load(std::memory_order_acquire);
+            const bool stopping = !running.load(std::memory_order_acquire);
+            const bool drained = drainInto(batch);
+            std::ranges::sort(batch, {}, &Record::seq);
+            std::size_t ready = 0;
+            while (ready < batch.size() && (batch[ready].seq == expected || (stopping && !drained))) {
+                expected = batch[ready++].seq + 1;
+            }
+            if (ready != 0) {
+                std::FILE* file = output.load(std::memory_order_acquire);
+                for (std::size_t i = 0; i < ready; ++i) {
+                    const Record& record = batch[i];
+                    std::fwrite(record.text.data(), 1, record.text.size(),
+                                record.channel == Channel::Console ? stdout : file);
+                }
+                std::fflush(stdout);
+                std::fflush(file);
+                batch.erase(batch.begin(), batch.begin() + static_cast<std::ptrdiff_t>(ready));
+                writtenSeq.store(expected, std::memory_order_release);
+            }
+            cycles.fetch_add(1, std::memory_order_release);
+            cycles.notify_all();
+            if (stopping && !drained) {
+                break;
+            }
+            if (!drained && !stopping) {
+                pending.wait(seen, std::memory_order_acquire);
+            }
+        }
+    }
+
+public:
+    static LogSink& instance() {
+        static LogSink sink;
+        return sink;
+    }
+
+    LogSink(const LogSink&) = delete;
+    LogSink& operator=(const LogSink&) = delete;
+
+    void write(std::string text, Channel channel = Channel::Console) {
+        ThreadBuffer& buffer = localBuffer();
+        const std::size_t tail = buffer.tail.load(std::memory_order_relaxed);
+        while (tail - buffer.head.load(std::memory_order_acquire) == BufferCapacity) {
+            if (channel == Channel::Diagnostic &&
+                dropPolicy.load(std::memory_order_relaxed) == DropPolicy::DropNewest) {
+                droppedRecords.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            wake();
+            std::this_thread::yield();
+        }
+        Record& record = buffer.slots[tail % BufferCapacity];
+        record.seq = nextSeq.fetch_add(1, std::memory_order_relaxed);
+        record.channel = channel;
+        record.text = std::move(text);
+        buffer.tail.store(tail + 1, std::memory_order_release);
+        wake();
+    }
+
+    // Blocks until every record written before the call has reached the output.
+    void flush() {
+        const auto target = nextSeq.load(std::memory_order_relaxed);
+        while (writtenSeq.load(std::memory_order_acquire) < target) {
+            const auto start = cycles.load(std::memory_order_acquire);
+            wake();
+            waitForCycle(start + 1);
+        }
+    }
+
+    void openFile(const std::string& path) {
+        std::FILE* file = std::fopen(path.c_str(), "a");
+        if (file == nullptr) {
+            throw std::runtime_error("Cannot open log file: " + path);
+        }
+        flush();
+        std::FILE* previous = output.exchange(file, std::memory_order_acq_rel);
+        if (previous != stdout) {
+            std::fclose(previous);
+        }
+    }
+
+    void setDropPolicy(DropPolicy policy) {
+        dropPolicy.store(policy, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] std::uint64_t dropped() const {
+        return droppedRecords.load(std::memory_order_relaxed);
+    }
+
+    ~LogSink() {
+        running.store(false, std::memory_order_release);
+        wake();
+        writer.join();
+        std::FILE* out = output.load(std::memory_order_acquire);
+        if (out != stdout) {
+            std::fclose(out);
+        }
+    }
+};
+
+class LogLine {
+private:
+    std::ostringstream stream;
+    LogSink::Channel channel;
+public:
+    explicit LogLine(LogSink::Channel channel = LogSink::Channel::Console) : channel(channel) {}
+
+    template <typename T>
+    LogLine& operator<<(const T& value) {
+        stream << value;
+        return *this;
+    }
+
+    ~LogLine() {
+        stream << '\n';
+        LogSink::instance().write(std::move(stream).str(), channel);
+    }
+};
+
+// A LogLine for what happens in the background rather than in answer to a command.
+class DiagnosticLine : public LogLine {
+public:
+    DiagnosticLine() : LogLine(LogSink::Channel::Diagnostic) {}
+};
+
+enum class AnimalKind : std::uint8_t { Dog, Cat };
+
+inline constexpr std::size_t AnimalKindCount = 2;
 
 class Animal {
 public:
@@ -18,21 +284,29 @@ public:
     virtual void display() const = 0;
     [[nodiscard]] virtual Animal* clone() const = 0;
     [[nodiscard]] virtual std::string getType() const = 0;
+    [[nodiscard]] virtual AnimalKind getKind() const = 0;
+    [[nodiscard]] virtual const std::string& getName() const = 0;
     virtual void info() const = 0;
+    virtual void renderDisplay(std::string& out) const = 0;
+    virtual void renderInfo(std::string& out) const = 0;
 };
 
-class Dog : public Animal {
+class Dog final : public Animal {
 private:
     std::string name;
 public:
+    static constexpr AnimalKind staticKind = AnimalKind::Dog;
+
     explicit Dog(std::string name) : name(std::move(name)) {}
 
     void speak() const override {
-        std::cout << name << " says Woof!" << std::endl;
+        LogLine() << name << " says Woof!";
     }
 
     void display() const override {
-        std::cout << "Dog: " << name << std::endl;
+        std::string line;
+        renderDisplay(line);
+        LogSink::instance().write(std::move(line));
     }
 
     [[nodiscard]] Animal* clone() const override {
@@ -43,23 +317,93 @@ public:
         return "Dog";
     }
 
+    [[nodiscard]] AnimalKind getKind() const override {
+        return staticKind;
+    }
+
+    [[nodiscard]] const std::string& getName() const override {
+        return name;
+    }
+
     void info() const override {
-        std::cout << "Dog Info: " << name << std::endl;
+        std::string line;
+        renderInfo(line);
+        LogSink::instance().write(std::move(line));
+    }
+
+    void renderDisplay(std::string& out) const override {
+        appendDisplayLine(out, name);
+    }
+
+    void renderInfo(std::string& out) const override {
+        appendInfoLine(out, name);
+    }
+
+    static void appendDisplayLine(std::string& out, std::string_view name) {
+        out.append("Dog: ").append(name).push_back('\n');
+    }
+
+    static void appendInfoLine(std::string& out, std::string_view name) {
+        out.append("Dog Info: ").append(name).push_back('\n');
+    }
+
+    static void displayBatch(std::span<const Animal* const> animals, std::string& out, std::span<std::size_t> ends) {
+        for (std::size_t i = 0; i < animals.size(); ++i) {
+            static_cast<const Dog*>(animals[i])->renderDisplay(out);
+            ends[i] = out.size();
+        }
+    }
+
+    static void displayBatch(std::span<const std::string_view> names, std::string& out, std::span<std::size_t> ends) {
+        for (std::size_t i = 0; i < names.size(); ++i) {
+            appendDisplayLine(out, names[i]);
+            ends[i] = out.size();
+        }
+    }
+
+    static void displayBatch(std::span<const Dog> animals, std::string& out) {
+        for (const Dog& animal : animals) {
+            animal.renderDisplay(out);
+        }
+    }
+
+    static void infoBatch(std::span<const Animal* const> animals, std::string& out, std::span<std::size_t> ends) {
+        for (std::size_t i = 0; i < animals.size(); ++i) {
+            static_cast<const Dog*>(animals[i])->renderInfo(out);
+            ends[i] = out.size();
+        }
+    }
+
+    static void infoBatch(std::span<const std::string_view> names, std::string& out, std::span<std::size_t> ends) {
+        for (std::size_t i = 0; i < names.size(); ++i) {
+            appendInfoLine(out, names[i]);
+            ends[i] = out.size();
+        }
+    }
+
+    static void infoBatch(std::span<const Dog> animals, std::string& out) {
+        for (const Dog& animal : animals) {
+            animal.renderInfo(out);
+        }
     }
 };
 
-class Cat : public Animal {
+class Cat final : public Animal {
 private:
     std::string name;
 public:
+    static constexpr AnimalKind staticKind = AnimalKind::Cat;
+
     explicit Cat(std::string name) : name(std::move(name)) {}
 
     void speak() const override {
-        std::cout << name << " says Meow!" << std::endl;
+        LogLine() << name << " says Meow!";
     }
 
     void display() const override {
-        std::cout << "Cat: " << name << std::endl;
+        std::string line;
+        renderDisplay(line);
+        LogSink::instance().write(std::move(line));
     }
 
     [[nodiscard]] Animal* clone() const override {
@@ -70,203 +414,8591 @@ public:
         return "Cat";
     }
 
-    void info() const override {
-        std::cout << "Cat Info: " << name << std::endl;
+    [[nodiscard]] AnimalKind getKind() const override {
+        return staticKind;
     }
-};
 
-class AbstractAnimalFactory {
-public:
-    virtual ~AbstractAnimalFactory() = default;
-    virtual std::shared_ptr<Animal> createAnimal(const std::string& name) = 0;
-};
+    [[nodiscard]] const std::string& getName() const override {
+        return name;
+    }
 
-class DogFactory : public AbstractAnimalFactory {
-public:
-    std::shared_ptr<Animal> createAnimal(const std::string& name) override {
-        return std::make_shared<Dog>(name);
+    void info() const override {
+        std::string line;
+        renderInfo(line);
+        LogSink::instance().write(std::move(line));
     }
-};
 
-class CatFactory : public AbstractAnimalFactory {
-public:
-    std::shared_ptr<Animal> createAnimal(const std::string& name) override {
-        return std::make_shared<Cat>(name);
+    void renderDisplay(std::string& out) const override {
+        appendDisplayLine(out, name);
     }
-};
 
-class AnimalContainer {
-private:
-    std::vector<std::shared_ptr<Animal>> container;
-    static int instanceCount;
-public:
-    AnimalContainer() {
-        ++instanceCount;
+    void renderInfo(std::string& out) const override {
+        appendInfoLine(out, name);
     }
 
-    void addAnimal(const std::shared_ptr<Animal>& animal) {
-        container.push_back(animal);
+    static void appendDisplayLine(std::string& out, std::string_view name) {
+        out.append("Cat: ").append(name).push_back('\n');
     }
 
-    void displayAll() const {
-        for (const auto& animal : container) {
-            animal->display();
+    static void appendInfoLine(std::string& out, std::string_view name) {
+        out.append("Cat Info: ").append(name).push_back('\n');
+    }
+
+    static void displayBatch(std::span<const Animal* const> animals, std::string& out, std::span<std::size_t> ends) {
+        for (std::size_t i = 0; i < animals.size(); ++i) {
+            static_cast<const Cat*>(animals[i])->renderDisplay(out);
+            ends[i] = out.size();
         }
     }
 
-    void removeAnimal(const std::string& name) {
-        std::erase_if(container, [&name](const std::shared_ptr<Animal>& animal) {
-            return animal->getType() == name;
-        });
+    static void displayBatch(std::span<const std::string_view> names, std::string& out, std::span<std::size_t> ends) {
+        for (std::size_t i = 0; i < names.size(); ++i) {
+            appendDisplayLine(out, names[i]);
+            ends[i] = out.size();
+        }
     }
 
-    void displayAnimalInfo(const std::string& name) const {
-        for (const auto& animal : container) {
-            if (animal->getType() == name) {
-                animal->info();
-            }
+    static void displayBatch(std::span<const Cat> animals, std::string& out) {
+        for (const Cat& animal : animals) {
+            animal.renderDisplay(out);
         }
     }
 
-    void sortAnimals() {
-        std::ranges::sort(container, [](const std::shared_ptr<Animal>& a, const std::shared_ptr<Animal>& b) {
-            return a->getType() < b->getType();
-        });
+    static void infoBatch(std::span<const Animal* const> animals, std::string& out, std::span<std::size_t> ends) {
+        for (std::size_t i = 0; i < animals.size(); ++i) {
+            static_cast<const Cat*>(animals[i])->renderInfo(out);
+            ends[i] = out.size();
+        }
     }
 
-    static void showInstanceCount() {
-        std::cout << "Total AnimalContainer instances: " << instanceCount << std::endl;
+    static void infoBatch(std::span<const std::string_view> names, std::string& out, std::span<std::size_t> ends) {
+        for (std::size_t i = 0; i < names.size(); ++i) {
+            appendInfoLine(out, names[i]);
+            ends[i] = out.size();
+        }
     }
 
-    ~AnimalContainer() {
-        --instanceCount;
+    static void infoBatch(std::span<const Cat> animals, std::string& out) {
+        for (const Cat& animal : animals) {
+            animal.renderInfo(out);
+        }
     }
 };
 
-int AnimalContainer::instanceCount = 0;
+// Fixed-size block pool for animal objects. Each thread allocates from its own magazine; a block
+// freed by another thread goes back to its owner through a lock-free remote-free stack.
+class AnimalBlockPool {
+private:
+    struct ThreadCache;
 
-class AnimalObserver {
-public:
-    virtual ~AnimalObserver() = default;
-    virtual void update(const std::shared_ptr<Animal>& animal) = 0;
-};
+    struct alignas(16) BlockHeader {
+        ThreadCache* owner;
+        BlockHeader* next;
+    };
+
+    static constexpr std::size_t BlockSize = 128;
+    static constexpr std::size_t SlabBlocks = 64;
+
+    struct ThreadCache {
+        BlockHeader* localFree = nullptr;
+        std::atomic<BlockHeader*> remoteFree{nullptr};
+        std::atomic<std::uint64_t> allocations{0};
+        std::atomic<std::uint64_t> localFrees{0};
+        std::atomic<std::uint64_t> remoteFrees{0};
+        std::atomic<std::uint64_t> slabs{0};
+    };
+
+    // Caches outlive their threads: an exiting thread parks its cache for the next new thread.
+    struct CacheHandle {
+        ThreadCache* cache;
+
+        CacheHandle() : cache(adopt()) {}
+
+        ~CacheHandle() {
+            cacheReleased = true;
+            std::lock_guard<std::mutex> lock(registryMutex);
+            orphans.push_back(cache);
+        }
+    };
+
+    static inline std::mutex registryMutex;
+    static inline std::vector<ThreadCache*> caches;
+    static inline std::vector<ThreadCache*> orphans;
+    static inline thread_local bool cacheReleased = false;
+
+    static ThreadCache* adopt() {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        if (!orphans.empty()) {
+            ThreadCache* cache = orphans.back();
+            orphans.pop_back();
+            return cache;
+        }
+        caches.push_back(new ThreadCache());
+        return caches.back();
+    }
+
+    static ThreadCache* local() {
+        if (cacheReleased) {
+            return nullptr;
+        }
+        thread_local CacheHandle handle;
+        return handle.cache;
+    }
+
+    static void refill(ThreadCache& cache) {
+        if ((cache.localFree = cache.remoteFree.exchange(nullptr, std::memory_order_acquire)) != nullptr) {
+            return;
+        }
+        auto* slab = static_cast<char*>(::operator new(BlockSize * SlabBlocks, std::align_val_t{16}));
+        for (std::size_t i = 0; i < SlabBlocks; ++i) {
+            auto* block = reinterpret_cast<BlockHeader*>(slab + i * BlockSize);
+            block->owner = &cache;
+            block->next = cache.localFree;
+            cache.localFree = block;
+        }
+        cache.slabs.fetch_add(1, std::memory_order_relaxed);
+    }
 
-class AnimalNotifier {
-private:
-    std::list<std::shared_ptr<AnimalObserver>> observers;
 public:
-    void addObserver(const std::shared_ptr<AnimalObserver>& observer) {
-        observers.push_back(observer);
+    static constexpr std::size_t MaxPayload = BlockSize - sizeof(BlockHeader);
+
+    static void* allocate(std::size_t bytes) {
+        if (bytes > MaxPayload) {
+            return ::operator new(bytes);
+        }
+        ThreadCache* cache = local();
+        if (cache == nullptr) {
+            // A thread past its cache's release still gets a headed block; owner == nullptr sends it
+            // back to the global heap.
+            auto* block = static_cast<BlockHeader*>(::operator new(BlockSize, std::align_val_t{16}));
+            block->owner = nullptr;
+            return block + 1;
+        }
+        if (cache->localFree == nullptr) {
+            refill(*cache);
+        }
+        BlockHeader* block = cache->localFree;
+        cache->localFree = block->next;
+        cache->allocations.fetch_add(1, std::memory_order_relaxed);
+        return block + 1;
+    }
+
+    static void deallocate(void* payload, std::size_t bytes) {
+        if (bytes > MaxPayload) {
+            ::operator delete(payload);
+            return;
+        }
+        BlockHeader* block = static_cast<BlockHeader*>(payload) - 1;
+        ThreadCache* owner = block->owner;
+        if (owner == nullptr) {
+            ::operator delete(block, std::align_val_t{16});
+        } else if (owner == local()) {
+            block->next = owner->localFree;
+            owner->localFree = block;
+            owner->localFrees.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            block->next = owner->remoteFree.load(std::memory_order_relaxed);
+            while (!owner->remoteFree.compare_exchange_weak(block->next, block, std::memory_order_release,
+                                                            std::memory_order_relaxed)) {
+            }
+            owner->remoteFrees.fetch_add(1, std::memory_order_relaxed);
+        }
     }
 
-    void notify(const std::shared_ptr<Animal>& animal) {
-        for (const auto& observer : observers) {
-            observer->update(animal);
+    static void reportMetrics() {
+        std::uint64_t allocations = 0, localFrees = 0, remoteFrees = 0, slabs = 0;
+        std::size_t threadCaches = 0;
+        {
+            std::lock_guard<std::mutex> lock(registryMutex);
+            threadCaches = caches.size();
+            for (const ThreadCache* cache : caches) {
+                allocations += cache->allocations.load(std::memory_order_relaxed);
+                localFrees += cache->localFrees.load(std::memory_order_relaxed);
+                remoteFrees += cache->remoteFrees.load(std::memory_order_relaxed);
+                slabs += cache->slabs.load(std::memory_order_relaxed);
+            }
         }
+        LogLine() << "Animal pool: " << threadCaches << " thread caches, " << slabs << " slabs, " << allocations
+                  << " allocations, " << localFrees << " local frees, " << remoteFrees << " remote frees";
     }
 };
 
-class AnimalDetailsObserver : public AnimalObserver {
+template <typename T>
+class AnimalAllocator {
 public:
-    void update(const std::shared_ptr<Animal>& animal) override {
-        std::lock_guard<std::mutex> lock(coutMutex);
-        std::cout << "Observer: ";
-        animal->info();
+    using value_type = T;
+
+    AnimalAllocator() = default;
+
+    template <typename U>
+    AnimalAllocator(const AnimalAllocator<U>&) {}
+
+    T* allocate(std::size_t count) {
+        return static_cast<T*>(AnimalBlockPool::allocate(count * sizeof(T)));
+    }
+
+    void deallocate(T* block, std::size_t count) {
+        AnimalBlockPool::deallocate(block, count * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const AnimalAllocator<U>&) const {
+        return true;
     }
 };
 
-class AnimalFactory {
-public:
-    static std::shared_ptr<Animal> createAnimal(const std::string& type, const std::string& name) {
-        if (type == "Dog") {
-            return std::make_shared<Dog>(name);
-        } else if (type == "Cat") {
-            return std::make_shared<Cat>(name);
-        } else {
-            throw std::invalid_argument("Unknown animal type");
+template <typename T, typename... Args>
+std::shared_ptr<Animal> makeAnimal(Args&&... args) {
+    return std::allocate_shared<T>(AnimalAllocator<T>(), std::forward<Args>(args)...);
+}
+
+// Per-kind batch kernels: each renders a run of animals of one kind (and only that kind)
+// and records where each line ends in the output buffer.
+struct AnimalKindOps {
+    using BatchKernel = void (*)(std::span<const Animal* const>, std::string&, std::span<std::size_t>);
+    using NameKernel = void (*)(std::span<const std::string_view>, std::string&, std::span<std::size_t>);
+
+    std::string_view type;
+    std::shared_ptr<Animal> (*create)(std::string name);
+    void (*appendDisplayLine)(std::string& out, std::string_view name);
+    BatchKernel displayBatch;
+    BatchKernel infoBatch;
+    NameKernel displayNames;
+    NameKernel infoNames;
+
+    template <typename T>
+    static constexpr AnimalKindOps of(std::string_view type) {
+        return {type,
+                [](std::string name) -> std::shared_ptr<Animal> { return makeAnimal<T>(std::move(name)); },
+                &T::appendDisplayLine,
+                &T::displayBatch, &T::infoBatch, &T::displayBatch, &T::infoBatch};
+    }
+};
+
+inline constexpr std::array<AnimalKindOps, AnimalKindCount> animalKinds{{
+    AnimalKindOps::of<Dog>("Dog"),
+    AnimalKindOps::of<Cat>("Cat"),
+}};
+
+inline std::optional<AnimalKind> kindFromType(std::string_view type) {
+    for (std::size_t i = 0; i < animalKinds.size(); ++i) {
+        if (animalKinds[i].type == type) {
+            return static_cast<AnimalKind>(i);
+        }
+    }
+    return std::nullopt;
+}
+
+// Position of each kind when kinds are ordered by type name.
+inline constexpr std::array<std::uint8_t, AnimalKindCount> kindSortRank = [] {
+    std::array<std::uint8_t, AnimalKindCount> ranks{};
+    for (std::size_t i = 0; i < AnimalKindCount; ++i) {
+        for (std::size_t j = 0; j < AnimalKindCount; ++j) {
+            ranks[i] += animalKinds[j].type < animalKinds[i].type;
         }
     }
+    return ranks;
+}();
+
+// Normalized sort key: kind rank in the top byte, then the first seven name bytes big-endian,
+// so comparing two keys as integers matches comparing (type, name) whenever the keys differ.
+inline std::uint64_t abbreviatedKey(AnimalKind kind, std::string_view name) {
+    std::uint64_t key = std::uint64_t{kindSortRank[static_cast<std::size_t>(kind)]} << 56;
+    const std::size_t prefix = std::min<std::size_t>(name.size(), 7);
+    for (std::size_t i = 0; i < prefix; ++i) {
+        key |= std::uint64_t{static_cast<unsigned char>(name[i])} << (48 - 8 * i);
+    }
+    return key;
+}
+
+struct SortEntry {
+    std::uint64_t key;
+    std::size_t slot;
 };
 
-void menu() {
-    std::cout << "1. Add Animal\n";
-    std::cout << "2. Display All Animals\n";
-    std::cout << "3. Remove Animal\n";
-    std::cout << "4. Display Animal Info\n";
-    std::cout << "5. Sort Animals\n";
-    std::cout << "6. Show AnimalContainer Instance Count\n";
-    std::cout << "7. Exit\n";
+// Stable LSD radix sort on the 64-bit key, skipping bytes that are the same in every entry.
+inline void radixSortEntries(std::vector<SortEntry>& entries) {
+    if (entries.size() < 64) {
+        std::ranges::stable_sort(entries, {}, &SortEntry::key);
+        return;
+    }
+    std::vector<SortEntry> scratch(entries.size());
+    for (unsigned shift = 0; shift < 64; shift += 8) {
+        std::array<std::size_t, 257> counts{};
+        for (const SortEntry& entry : entries) {
+            ++counts[((entry.key >> shift) & 0xff) + 1];
+        }
+        if (std::ranges::find(counts, entries.size()) != counts.end()) {
+            continue;
+        }
+        for (std::size_t i = 1; i < counts.size(); ++i) {
+            counts[i] += counts[i - 1];
+        }
+        for (const SortEntry& entry : entries) {
+            scratch[counts[(entry.key >> shift) & 0xff]++] = entry;
+        }
+        entries.swap(scratch);
+    }
 }
 
-void threadTest(const AnimalContainer& container) {
-    std::cout << "Started a thread for displaying all animals.\n";
-    std::this_thread::sleep_for(std::chrono::seconds(1));
-    container.displayAll();
+// Slot order by (type, name). Full names are only compared inside runs of equal keys.
+template <typename KindAt, typename NameAt>
+std::vector<std::size_t> sortOrderByTypeAndName(std::span<const std::size_t> slots, KindAt kindAt, NameAt nameAt) {
+    std::vector<SortEntry> entries;
+    entries.reserve(slots.size());
+    for (std::size_t slot : slots) {
+        entries.push_back({abbreviatedKey(kindAt(slot), nameAt(slot)), slot});
+    }
+    radixSortEntries(entries);
+    for (auto run = entries.begin(); run != entries.end();) {
+        const auto end = std::find_if(run, entries.end(), [&](const SortEntry& entry) { return entry.key != run->key; });
+        if (end - run > 1) {
+            std::stable_sort(run, end, [&](const SortEntry& a, const SortEntry& b) {
+                return nameAt(a.slot) < nameAt(b.slot);
+            });
+        }
+        run = end;
+    }
+    std::vector<std::size_t> order;
+    order.reserve(entries.size());
+    for (const SortEntry& entry : entries) {
+        order.push_back(entry.slot);
+    }
+    return order;
 }
 
-int main() {
-    AnimalContainer container;
-    AnimalNotifier notifier;
-    AnimalDetailsObserver observer;
+struct QueryPredicate {
+    enum class Type { KindEquals, NameEquals, NameStartsWith };
 
-    notifier.addObserver(std::make_shared<AnimalDetailsObserver>(observer));
+    Type type;
+    AnimalKind kind{};
+    std::string text;
+};
 
-    bool running = true;
-    while (running) {
-        menu();
-        int choice;
-        std::cin >> choice;
+struct AnimalKindField {
+    QueryPredicate operator==(AnimalKind kind) const {
+        return {QueryPredicate::Type::KindEquals, kind, {}};
+    }
+};
 
-        switch (choice) {
-        case 1: {
-            std::string type, name;
-            std::cout << "Enter animal type (Dog/Cat): ";
-            std::cin >> type;
-            std::cout << "Enter animal name: ";
-            std::cin >> name;
+struct AnimalNameField {
+    QueryPredicate operator==(std::string_view name) const {
+        return {QueryPredicate::Type::NameEquals, {}, std::string(name)};
+    }
 
-            try {
-                auto animal = AnimalFactory::createAnimal(type, name);
-                container.addAnimal(animal);
-                notifier.notify(animal);
-            } catch (const std::invalid_argument& e) {
-                std::cout << e.what() << std::endl;
-            }
+    [[nodiscard]] QueryPredicate startsWith(std::string_view prefix) const {
+        return {QueryPredicate::Type::NameStartsWith, {}, std::string(prefix)};
+    }
+};
+
+inline constexpr AnimalKindField animalKind;
+inline constexpr AnimalNameField animalName;
+
+enum class QueryOrder { Name, TypeAndName };
+
+// Conjunction of predicates plus ordering and limit. Predicates are kept split by field so the
+// cheap kind test runs before any name bytes are touched.
+struct QuerySpec {
+    std::optional<AnimalKind> kind;
+    std::vector<std::string> nameEquals;
+    std::vector<std::string> namePrefixes;
+    bool empty = false;
+    std::optional<QueryOrder> order;
+    std::size_t limit = static_cast<std::size_t>(-1);
+
+    void add(const QueryPredicate& predicate) {
+        switch (predicate.type) {
+        case QueryPredicate::Type::KindEquals:
+            empty = empty || (kind && *kind != predicate.kind);
+            kind = predicate.kind;
             break;
-        }
-        case 2:
-            container.displayAll();
+        case QueryPredicate::Type::NameEquals:
+            nameEquals.push_back(predicate.text);
             break;
-        case 3: {
-            std::string name;
-            std::cout << "Enter animal name to remove: ";
-            std::cin >> name;
-            container.removeAnimal(name);
+        case QueryPredicate::Type::NameStartsWith:
+            namePrefixes.push_back(predicate.text);
             break;
         }
-        case 4: {
-            std::string name;
-            std::cout << "Enter animal type to get info: ";
-            std::cin >> name;
-            container.displayAnimalInfo(name);
-            break;
+    }
+
+    [[nodiscard]] bool matches(AnimalKind slotKind, std::string_view name) const {
+        if (kind && slotKind != *kind) {
+            return false;
         }
-        case 5:
-            container.sortAnimals();
-            std::cout << "Animals sorted.\n";
-            break;
-        case 6:
-            AnimalContainer::showInstanceCount();
-            break;
-        case 7:
-            running = false;
-            break;
-        default:
-            std::cout << "Invalid option. Please try again.\n";
+        for (const auto& equals : nameEquals) {
+            if (name != equals) {
+                return false;
+            }
+        }
+        for (const auto& prefix : namePrefixes) {
+            if (!name.starts_with(prefix)) {
+                return false;
+            }
         }
+        return true;
+    }
+};
+
+inline void appendDisplayRow(std::string& out, AnimalKind kind, std::string_view name) {
+    animalKinds[static_cast<std::size_t>(kind)].appendDisplayLine(out, name);
+}
 
-        std::thread t(threadTest, std::ref(container));
-        t.join();
+// Runs the filter/sort/limit stages of a query in one pass over the access path a container
+// picked. access(visit) calls visit(slot) per candidate and stops once visit returns false.
+template <typename Access, typename KindAt, typename NameAt, typename Emit>
+void finishQuery(const QuerySpec& spec, Access access, KindAt kindAt, NameAt nameAt, Emit emit) {
+    if (spec.empty || spec.limit == 0) {
+        return;
+    }
+    if (!spec.order) {
+        std::size_t emitted = 0;
+        access([&](std::size_t slot) {
+            if (!spec.matches(kindAt(slot), nameAt(slot))) {
+                return true;
+            }
+            emit(kindAt(slot), nameAt(slot));
+            return ++emitted < spec.limit;
+        });
+        return;
+    }
+
+    const bool byType = *spec.order == QueryOrder::TypeAndName;
+    const auto sortKind = [&](std::size_t slot) { return byType ? kindAt(slot) : AnimalKind{}; };
+    const auto less = [&](std::size_t a, std::size_t b) {
+        const auto rankA = kindSortRank[static_cast<std::size_t>(sortKind(a))];
+        const auto rankB = kindSortRank[static_cast<std::size_t>(sortKind(b))];
+        return rankA != rankB ? rankA < rankB : nameAt(a) < nameAt(b);
+    };
+    std::vector<std::size_t> selected;
+    access([&](std::size_t slot) {
+        if (!spec.matches(kindAt(slot), nameAt(slot))) {
+            return true;
+        }
+        if (selected.size() < spec.limit) {
+            selected.push_back(slot);
+            if (selected.size() == spec.limit) {
+                std::ranges::make_heap(selected, less);
+            }
+        } else if (less(slot, selected.front())) {
+            std::ranges::pop_heap(selected, less);
+            selected.back() = slot;
+            std::ranges::push_heap(selected, less);
+        }
+        return true;
+    });
+    for (std::size_t slot : sortOrderByTypeAndName(selected, sortKind, nameAt)) {
+        emit(kindAt(slot), nameAt(slot));
+    }
+}
+
+// LRU cache of rendered query results. Each entry remembers the per-kind modification versions
+// of the kinds it can contain and is served only while those versions are unchanged.
+class QueryResultCache {
+public:
+    using Versions = std::array<std::uint64_t, AnimalKindCount>;
+
+private:
+    struct Entry {
+        std::string key;
+        std::string result;
+        Versions versions;
+        std::optional<AnimalKind> kind;
+    };
+
+    std::list<Entry> entries;
+    std::unordered_map<std::string_view, std::list<Entry>::iterator> byKey;
+    std::size_t bytes = 0;
+    std::size_t capacityBytes = std::size_t{1} << 20;
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+    std::uint64_t invalidations = 0;
+    std::uint64_t evictions = 0;
+
+    static std::size_t footprint(const Entry& entry) {
+        return entry.key.size() + entry.result.size() + sizeof(Entry);
+    }
+
+    static bool fresh(const Entry& entry, const Versions& current) {
+        if (entry.kind) {
+            const auto kind = static_cast<std::size_t>(*entry.kind);
+            return entry.versions[kind] == current[kind];
+        }
+        return entry.versions == current;
+    }
+
+    void erase(std::list<Entry>::iterator it) {
+        bytes -= footprint(*it);
+        byKey.erase(it->key);
+        entries.erase(it);
+    }
+
+    void evictToCapacity() {
+        while (bytes > capacityBytes && !entries.empty()) {
+            erase(std::prev(entries.end()));
+            ++evictions;
+        }
+    }
+
+public:
+    [[nodiscard]] const std::string* find(const std::string& key, const Versions& current) {
+        const auto it = byKey.find(key);
+        if (it == byKey.end()) {
+            ++misses;
+            return nullptr;
+        }
+        if (!fresh(*it->second, current)) {
+            erase(it->second);
+            ++invalidations;
+            ++misses;
+            return nullptr;
+        }
+        entries.splice(entries.begin(), entries, it->second);
+        ++hits;
+        return &entries.front().result;
+    }
+
+    void insert(std::string key, std::string result, const Versions& current, std::optional<AnimalKind> kind) {
+        if (const auto it = byKey.find(key); it != byKey.end()) {
+            erase(it->second);
+        }
+        entries.push_front(Entry{std::move(key), std::move(result), current, kind});
+        byKey.emplace(entries.front().key, entries.begin());
+        bytes += footprint(entries.front());
+        evictToCapacity();
+    }
+
+    void setCapacity(std::size_t capacity) {
+        capacityBytes = capacity;
+        evictToCapacity();
+    }
+
+    void reportMetrics() const {
+        LogLine() << "  query cache: " << entries.size() << " entries, " << bytes << "/" << capacityBytes
+                  << " bytes, " << hits << " hits, " << misses << " misses, " << invalidations
+                  << " invalidations, " << evictions << " evictions";
+    }
+};
+
+// Canonical cache key: predicate order and duplicates do not matter, strings are length-prefixed.
+inline std::string normalizedQueryKey(const QuerySpec& spec) {
+    const auto appendAll = [](std::string& key, char tag, std::vector<std::string> values) {
+        std::ranges::sort(values);
+        const auto [first, last] = std::ranges::unique(values);
+        values.erase(first, last);
+        for (const auto& value : values) {
+            key.append(1, tag).append(std::to_string(value.size())).append(1, ':').append(value);
+        }
+    };
+    std::string key = "q";
+    if (spec.empty) {
+        return key + "!";
+    }
+    key.append(spec.kind ? animalKinds[static_cast<std::size_t>(*spec.kind)].type : "*");
+    appendAll(key, '=', spec.nameEquals);
+    appendAll(key, '^', spec.namePrefixes);
+    key.append(spec.order ? (*spec.order == QueryOrder::Name ? "|n" : "|tn") : "|-");
+    key.append("|").append(std::to_string(spec.limit));
+    return key;
+}
+
+template <typename Source>
+class AnimalQuery {
+private:
+    const Source& source;
+    QuerySpec spec;
+public:
+    explicit AnimalQuery(const Source& source) : source(source) {}
+
+    AnimalQuery& where(const QueryPredicate& predicate) {
+        spec.add(predicate);
+        return *this;
+    }
+
+    AnimalQuery& sortBy(QueryOrder order) {
+        spec.order = order;
+        return *this;
+    }
+
+    AnimalQuery& take(std::size_t count) {
+        spec.limit = std::min(spec.limit, count);
+        return *this;
+    }
+
+    // Calls fn(kind, name) per result; the name is only valid during the call.
+    template <typename Fn>
+    void forEach(Fn fn) const {
+        source.executeQuery(spec, fn);
+    }
+
+    [[nodiscard]] std::size_t count() const {
+        std::size_t total = 0;
+        forEach([&total](AnimalKind, std::string_view) { ++total; });
+        return total;
+    }
+
+    [[nodiscard]] std::vector<std::shared_ptr<Animal>> collect() const {
+        std::vector<std::shared_ptr<Animal>> animals;
+        forEach([&animals](AnimalKind kind, std::string_view name) {
+            animals.push_back(animalKinds[static_cast<std::size_t>(kind)].create(std::string(name)));
+        });
+        return animals;
+    }
+
+    [[nodiscard]] std::string render() const {
+        return source.renderQuery(spec);
+    }
+
+    void display() const {
+        std::string out = render();
+        if (!out.empty()) {
+            LogSink::instance().write(std::move(out));
+        }
+    }
+};
+
+class AbstractAnimalFactory {
+public:
+    virtual ~AbstractAnimalFactory() = default;
+    virtual std::shared_ptr<Animal> createAnimal(const std::string& name) = 0;
+};
+
+class DogFactory : public AbstractAnimalFactory {
+public:
+    std::shared_ptr<Animal> createAnimal(const std::string& name) override {
+        return makeAnimal<Dog>(name);
+    }
+};
+
+class CatFactory : public AbstractAnimalFactory {
+public:
+    std::shared_ptr<Animal> createAnimal(const std::string& name) override {
+        return makeAnimal<Cat>(name);
+    }
+};
+
+struct HugePageOptions {
+    bool hugeTlb = false;
+    bool transparent = false;
+    bool prefault = false;
+    bool releaseAfterCompaction = true;
+    std::size_t mapThreshold = std::size_t{1} << 21;
+};
+
+// Backing memory for storage columns and arenas. Blocks past mapThreshold are mmap'd so they
+// can use huge pages, be prefaulted on bulk load and hand unused tails back after compaction.
+class StorageMemory {
+public:
+    static constexpr std::size_t BlockOverhead = 64;
+
+private:
+    static constexpr std::size_t HeaderSize = BlockOverhead;
+    static constexpr std::size_t HugePageSize = std::size_t{1} << 21;
+
+    struct Header {
+        std::size_t mappedBytes;
+        bool mapped;
+    };
+
+    static inline HugePageOptions currentOptions;
+    static inline std::atomic<std::uint64_t> mappedBytes{0};
+    static inline std::atomic<std::uint64_t> hugeTlbBlocks{0};
+    static inline std::atomic<std::uint64_t> hugeTlbFallbacks{0};
+    static inline std::atomic<std::uint64_t> transparentBlocks{0};
+    static inline std::atomic<std::uint64_t> prefaultedBytes{0};
+    static inline std::atomic<std::uint64_t> releasedBytes{0};
+
+    static Header* header(void* block) {
+        return reinterpret_cast<Header*>(static_cast<char*>(block) - HeaderSize);
+    }
+
+    static std::size_t pageSize() {
+#if defined(__linux__)
+        static const auto size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        return size;
+#else
+        return 4096;
+#endif
+    }
+
+    // Largest page-aligned range inside [begin, end).
+    static std::pair<char*, std::size_t> innerPages(char* begin, char* end) {
+        const std::size_t page = pageSize();
+        const auto first = (reinterpret_cast<std::uintptr_t>(begin) + page - 1) & ~(page - 1);
+        const auto last = reinterpret_cast<std::uintptr_t>(end) & ~(page - 1);
+        if (last <= first) {
+            return {nullptr, 0};
+        }
+        return {reinterpret_cast<char*>(first), last - first};
+    }
+
+#if defined(__linux__)
+    static void* map(std::size_t bytes, std::size_t& mapped) {
+        const HugePageOptions& options = currentOptions;
+        if (options.hugeTlb) {
+            mapped = (bytes + HugePageSize - 1) & ~(HugePageSize - 1);
+            void* block = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (block != MAP_FAILED) {
+                ++hugeTlbBlocks;
+                return block;
+            }
+            ++hugeTlbFallbacks;
+        }
+        mapped = (bytes + pageSize() - 1) & ~(pageSize() - 1);
+        void* block = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (block == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        if (options.transparent && madvise(block, mapped, MADV_HUGEPAGE) == 0) {
+            ++transparentBlocks;
+        }
+        return block;
+    }
+#endif
+
+public:
+    static HugePageOptions& options() {
+        return currentOptions;
+    }
+
+    static void* allocate(std::size_t bytes) {
+        const std::size_t total = bytes + HeaderSize;
+        void* base = nullptr;
+        Header info{total, false};
+#if defined(__linux__)
+        if (total >= currentOptions.mapThreshold) {
+            base = map(total, info.mappedBytes);
+            info.mapped = true;
+            mappedBytes += info.mappedBytes;
+        }
+#endif
+        if (base == nullptr) {
+            base = ::operator new(total);
+        }
+        void* block = static_cast<char*>(base) + HeaderSize;
+        *header(block) = info;
+        return block;
+    }
+
+    static void deallocate(void* block) {
+        if (block == nullptr) {
+            return;
+        }
+        const Header info = *header(block);
+        void* base = header(block);
+#if defined(__linux__)
+        if (info.mapped) {
+            mappedBytes -= info.mappedBytes;
+            munmap(base, info.mappedBytes);
+            return;
+        }
+#endif
+        ::operator delete(base);
+    }
+
+    // Touches [block, block + bytes) up front so a bulk load does not page-fault its way in.
+    static void prefault(void* block, std::size_t bytes) {
+        if (block == nullptr || !currentOptions.prefault || !header(block)->mapped) {
+            return;
+        }
+        auto [pages, length] = innerPages(static_cast<char*>(block), static_cast<char*>(block) + bytes);
+        if (length == 0) {
+            return;
+        }
+#if defined(__linux__) && defined(MADV_POPULATE_WRITE)
+        if (madvise(pages, length, MADV_POPULATE_WRITE) != 0)
+#endif
+        {
+            for (std::size_t offset = 0; offset < length; offset += pageSize()) {
+                reinterpret_cast<volatile char*>(pages)[offset] = 0;
+            }
+        }
+        prefaultedBytes += length;
+    }
+
+    // Drops the physical pages behind an unused tail; the mapping stays valid and refaults as zeroes.
+    static void release(void* block, std::size_t usedBytes, std::size_t capacityBytes) {
+        if (block == nullptr || !currentOptions.releaseAfterCompaction || !header(block)->mapped) {
+            return;
+        }
+        auto [pages, length] = innerPages(static_cast<char*>(block) + usedBytes,
+                                          static_cast<char*>(block) + capacityBytes);
+#if defined(__linux__)
+        if (length != 0 && madvise(pages, length, MADV_DONTNEED) == 0) {
+            releasedBytes += length;
+        }
+#else
+        (void)pages;
+        (void)length;
+#endif
+    }
+
+    static void reportMetrics() {
+        const HugePageOptions& options = currentOptions;
+        LogLine() << "Storage memory: hugetlb=" << options.hugeTlb << " thp=" << options.transparent
+                  << " prefault=" << options.prefault << " release=" << options.releaseAfterCompaction;
+        LogLine() << "  mapped bytes: " << mappedBytes << ", hugetlb blocks: " << hugeTlbBlocks
+                  << " (fallbacks: " << hugeTlbFallbacks << "), thp blocks: " << transparentBlocks;
+        LogLine() << "  prefaulted bytes: " << prefaultedBytes << ", released bytes: " << releasedBytes;
+    }
+};
+
+template <typename T>
+class StorageAllocator {
+public:
+    using value_type = T;
+
+    StorageAllocator() = default;
+
+    template <typename U>
+    StorageAllocator(const StorageAllocator<U>&) {}
+
+    T* allocate(std::size_t count) {
+        return static_cast<T*>(StorageMemory::allocate(count * sizeof(T)));
+    }
+
+    void deallocate(T* block, std::size_t) {
+        StorageMemory::deallocate(block);
+    }
+
+    template <typename U>
+    bool operator==(const StorageAllocator<U>&) const {
+        return true;
+    }
+};
+
+template <typename T>
+using StorageColumn = std::vector<T, StorageAllocator<T>>;
+
+using StorageArena = std::basic_string<char, std::char_traits<char>, StorageAllocator<char>>;
+
+template <typename Column>
+void prefaultColumn(Column& column) {
+    StorageMemory::prefault(column.data(), column.capacity() * sizeof(typename Column::value_type));
+}
+
+template <typename Column>
+void releaseColumnTail(Column& column) {
+    using Value = typename Column::value_type;
+    StorageMemory::release(column.data(), column.size() * sizeof(Value), column.capacity() * sizeof(Value));
+}
+
+enum class RenderTarget { Display, Info };
+
+template <typename Column>
+void retainColumn(Column& column, const std::vector<bool>& keep) {
+    std::size_t out = 0;
+    for (std::size_t i = 0; i < column.size(); ++i) {
+        if (keep[i]) {
+            column[out++] = std::move(column[i]);
+        }
+    }
+    column.resize(out);
+}
+
+template <typename Column>
+void permuteColumn(Column& column, std::span<const std::size_t> order) {
+    Column permuted;
+    permuted.reserve(column.size());
+    for (std::size_t from : order) {
+        permuted.push_back(std::move(column[from]));
+    }
+    column = std::move(permuted);
+}
+
+// Storage policy keeping the animal objects themselves, as the original container did.
+class PointerStorage {
+private:
+    std::vector<std::shared_ptr<Animal>> animals;
+    std::vector<AnimalKind> kinds;
+    std::vector<std::uint64_t> versions;
+public:
+    [[nodiscard]] std::size_t size() const {
+        return animals.size();
+    }
+
+    [[nodiscard]] AnimalKind kind(std::size_t slot) const {
+        return kinds[slot];
+    }
+
+    [[nodiscard]] std::uint64_t version(std::size_t slot) const {
+        return versions[slot];
+    }
+
+    [[nodiscard]] std::string_view name(std::size_t slot) const {
+        return animals[slot]->getName();
+    }
+
+    [[nodiscard]] std::shared_ptr<Animal> animal(std::size_t slot) const {
+        return animals[slot];
+    }
+
+    void reserve(std::size_t count, std::size_t) {
+        animals.reserve(count);
+        kinds.reserve(count);
+        versions.reserve(count);
+    }
+
+    bool compactStep(std::size_t) {
+        return false;
+    }
+
+    void reportMetrics() const {
+        LogLine() << "Pointer storage: " << size() << " slots";
+    }
+
+    void push(const std::shared_ptr<Animal>& animal, std::uint64_t version) {
+        animals.push_back(animal);
+        kinds.push_back(animal->getKind());
+        versions.push_back(version);
+    }
+
+    void retain(const std::vector<bool>& keep) {
+        retainColumn(animals, keep);
+        retainColumn(kinds, keep);
+        retainColumn(versions, keep);
+    }
+
+    void permute(std::span<const std::size_t> order) {
+        permuteColumn(animals, order);
+        permuteColumn(kinds, order);
+        permuteColumn(versions, order);
+    }
+
+    void renderBatch(AnimalKind kind, RenderTarget target, std::span<const std::size_t> slots, std::string& out,
+                     std::span<std::size_t> ends) const {
+        std::vector<const Animal*> batch;
+        batch.reserve(slots.size());
+        for (std::size_t slot : slots) {
+            batch.push_back(animals[slot].get());
+        }
+        const AnimalKindOps& ops = animalKinds[static_cast<std::size_t>(kind)];
+        (target == RenderTarget::Display ? ops.displayBatch : ops.infoBatch)(batch, out, ends);
+    }
+};
+
+// Name storage split into fixed-size segments. Removals only lower a segment's live byte count;
+// the compactor later moves surviving names out of sparse segments and unmaps the emptied ones.
+class NameArena {
+public:
+    using Handle = std::uint64_t;
+
+    static constexpr std::size_t SegmentBytes = (std::size_t{1} << 21) - StorageMemory::BlockOverhead;
+
+private:
+    static constexpr std::size_t NoSegment = static_cast<std::size_t>(-1);
+
+    struct Segment {
+        char* data = nullptr;
+        std::size_t used = 0;
+        std::size_t live = 0;
+        bool evacuating = false;
+    };
+
+    std::vector<Segment> segments;
+    std::vector<std::size_t> spare;
+    std::size_t tail = NoSegment;
+    bool passActive = false;
+    std::size_t passCursor = 0;
+    std::uint64_t movedBytes = 0;
+    std::uint64_t freedSegments = 0;
+
+    static std::size_t segmentOf(Handle handle) {
+        return static_cast<std::size_t>(handle >> 32);
+    }
+
+    static std::size_t offsetOf(Handle handle) {
+        return static_cast<std::size_t>(handle & 0xffffffffu);
+    }
+
+    std::size_t allocateSegment() {
+        std::size_t index = 0;
+        while (index < segments.size() && segments[index].data != nullptr) {
+            ++index;
+        }
+        if (index == segments.size()) {
+            segments.emplace_back();
+        }
+        segments[index].data = static_cast<char*>(StorageMemory::allocate(SegmentBytes));
+        return index;
+    }
+
+    void openTail() {
+        if (!spare.empty()) {
+            tail = spare.back();
+            spare.pop_back();
+        } else {
+            tail = allocateSegment();
+        }
+    }
+
+    void freeSegment(std::size_t index) {
+        StorageMemory::deallocate(segments[index].data);
+        segments[index] = Segment{};
+        ++freedSegments;
+    }
+
+    [[nodiscard]] bool sparse(std::size_t index) const {
+        const Segment& segment = segments[index];
+        return index != tail && segment.data != nullptr && segment.used != 0 && segment.live * 3 < segment.used * 2;
+    }
+
+public:
+    NameArena() = default;
+    NameArena(const NameArena&) = delete;
+    NameArena& operator=(const NameArena&) = delete;
+
+    ~NameArena() {
+        for (auto& segment : segments) {
+            StorageMemory::deallocate(segment.data);
+        }
+    }
+
+    [[nodiscard]] std::string_view view(Handle handle, std::uint32_t length) const {
+        return {segments[segmentOf(handle)].data + offsetOf(handle), length};
+    }
+
+    Handle append(std::string_view name) {
+        if (name.size() > SegmentBytes) {
+            throw std::length_error("Animal name too long");
+        }
+        if (tail == NoSegment || segments[tail].used + name.size() > SegmentBytes) {
+            openTail();
+        }
+        Segment& segment = segments[tail];
+        const Handle handle = (static_cast<Handle>(tail) << 32) | segment.used;
+        std::copy(name.begin(), name.end(), segment.data + segment.used);
+        segment.used += name.size();
+        segment.live += name.size();
+        return handle;
+    }
+
+    void release(Handle handle, std::uint32_t length) {
+        const std::size_t index = segmentOf(handle);
+        Segment& segment = segments[index];
+        segment.live -= length;
+        if (segment.live == 0 && index != tail) {
+            freeSegment(index);
+        }
+    }
+
+    void reserve(std::size_t bytes) {
+        std::size_t available = tail == NoSegment ? 0 : SegmentBytes - segments[tail].used;
+        available += spare.size() * SegmentBytes;
+        while (available < bytes) {
+            spare.push_back(allocateSegment());
+            StorageMemory::prefault(segments[spare.back()].data, SegmentBytes);
+            available += SegmentBytes;
+        }
+    }
+
+    // Rewrites up to slotBudget handles that point into segments being evacuated; returns false
+    // once no segment is sparse enough to be worth moving.
+    template <typename Handles, typename Lengths>
+    bool compactStep(Handles& handles, const Lengths& lengths, std::size_t slotBudget) {
+        if (!passActive) {
+            bool any = false;
+            for (std::size_t i = 0; i < segments.size(); ++i) {
+                segments[i].evacuating = sparse(i);
+                any = any || segments[i].evacuating;
+            }
+            if (!any) {
+                return false;
+            }
+            passActive = true;
+            passCursor = 0;
+        }
+        const std::size_t end = std::min(passCursor + slotBudget, handles.size());
+        for (; passCursor < end; ++passCursor) {
+            const std::size_t index = segmentOf(handles[passCursor]);
+            if (segments[index].evacuating) {
+                const std::uint32_t length = lengths[passCursor];
+                const Handle moved = append(view(handles[passCursor], length));
+                segments[index].live -= length;
+                handles[passCursor] = moved;
+                movedBytes += length;
+            }
+        }
+        if (passCursor < handles.size()) {
+            return true;
+        }
+        passActive = false;
+        bool more = false;
+        for (std::size_t i = 0; i < segments.size(); ++i) {
+            if (segments[i].evacuating) {
+                segments[i].evacuating = false;
+                if (segments[i].live == 0) {
+                    freeSegment(i);
+                }
+            }
+            more = more || sparse(i);
+        }
+        return more;
+    }
+
+    void reportMetrics() const {
+        std::size_t live = 0, used = 0, mapped = 0;
+        for (const auto& segment : segments) {
+            if (segment.data != nullptr) {
+                live += segment.live;
+                used += segment.used;
+                ++mapped;
+            }
+        }
+        LogLine() << "  name arena: " << mapped << " segments (" << spare.size() << " spare), " << live
+                  << " live of " << used << " used bytes, " << movedBytes << " bytes compacted, " << freedSegments
+                  << " segments freed";
+    }
+};
+
+// Storage policy keeping only kind/name columns; names live in a segmented arena.
+class ColumnStorage {
+private:
+    StorageColumn<AnimalKind> kinds;
+    StorageColumn<std::uint64_t> versions;
+    StorageColumn<NameArena::Handle> nameHandles;
+    StorageColumn<std::uint32_t> nameLengths;
+    NameArena nameArena;
+
+public:
+    [[nodiscard]] std::size_t size() const {
+        return kinds.size();
+    }
+
+    [[nodiscard]] AnimalKind kind(std::size_t slot) const {
+        return kinds[slot];
+    }
+
+    [[nodiscard]] std::uint64_t version(std::size_t slot) const {
+        return versions[slot];
+    }
+
+    [[nodiscard]] std::string_view name(std::size_t slot) const {
+        return nameArena.view(nameHandles[slot], nameLengths[slot]);
+    }
+
+    [[nodiscard]] std::shared_ptr<Animal> animal(std::size_t slot) const {
+        return animalKinds[static_cast<std::size_t>(kinds[slot])].create(std::string(name(slot)));
+    }
+
+    void push(const std::shared_ptr<Animal>& animal, std::uint64_t version) {
+        const std::string& name = animal->getName();
+        kinds.push_back(animal->getKind());
+        versions.push_back(version);
+        nameHandles.push_back(nameArena.append(name));
+        nameLengths.push_back(static_cast<std::uint32_t>(name.size()));
+    }
+
+    void reserve(std::size_t count, std::size_t nameBytes) {
+        kinds.reserve(count);
+        versions.reserve(count);
+        nameHandles.reserve(count);
+        nameLengths.reserve(count);
+        nameArena.reserve(nameBytes);
+        prefaultColumn(kinds);
+        prefaultColumn(versions);
+        prefaultColumn(nameHandles);
+        prefaultColumn(nameLengths);
+    }
+
+    void retain(const std::vector<bool>& keep) {
+        for (std::size_t i = 0; i < keep.size(); ++i) {
+            if (!keep[i]) {
+                nameArena.release(nameHandles[i], nameLengths[i]);
+            }
+        }
+        retainColumn(kinds, keep);
+        retainColumn(versions, keep);
+        retainColumn(nameHandles, keep);
+        retainColumn(nameLengths, keep);
+        releaseColumnTail(kinds);
+        releaseColumnTail(versions);
+        releaseColumnTail(nameHandles);
+        releaseColumnTail(nameLengths);
+    }
+
+    void permute(std::span<const std::size_t> order) {
+        permuteColumn(kinds, order);
+        permuteColumn(versions, order);
+        permuteColumn(nameHandles, order);
+        permuteColumn(nameLengths, order);
+    }
+
+    bool compactStep(std::size_t slotBudget) {
+        return nameArena.compactStep(nameHandles, nameLengths, slotBudget);
+    }
+
+    void reportMetrics() const {
+        LogLine() << "Column storage: " << size() << " slots";
+        nameArena.reportMetrics();
+    }
+
+    void renderBatch(AnimalKind kind, RenderTarget target, std::span<const std::size_t> slots, std::string& out,
+                     std::span<std::size_t> ends) const {
+        std::vector<std::string_view> batch;
+        batch.reserve(slots.size());
+        for (std::size_t slot : slots) {
+            batch.push_back(name(slot));
+        }
+        const AnimalKindOps& ops = animalKinds[static_cast<std::size_t>(kind)];
+        (target == RenderTarget::Display ? ops.displayNames : ops.infoNames)(batch, out, ends);
+    }
+};
+
+class NoNameIndex {
+public:
+    static constexpr bool enabled = false;
+
+    void add(std::string_view, std::size_t) {}
+
+    void remove(std::string_view, std::size_t) {}
+
+    template <typename Storage>
+    void rebuild(const Storage&) {}
+
+    template <typename Storage, typename Fn>
+    void find(const Storage&, std::string_view, Fn) const {}
+
+    template <typename Storage>
+    void findMany(const Storage&, std::span<const std::string_view>, std::span<std::size_t>) const {}
+};
+
+inline void prefetchRead(const void* address) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(address, 0, 1);
+#else
+    (void)address;
+#endif
+}
+
+// Open-addressing (linear probing) table of (name hash, slot) entries. Names are not stored:
+// a probe that matches the hash confirms against the storage column.
+class HashNameIndex {
+public:
+    static constexpr std::size_t NotFound = static_cast<std::size_t>(-1);
+
+private:
+    static constexpr std::uint64_t Empty = ~std::uint64_t{0};
+    static constexpr std::uint64_t Deleted = Empty - 1;
+    static constexpr std::size_t PrefetchGroup = 16;
+
+    struct Entry {
+        std::uint64_t hash = 0;
+        std::uint64_t slot = Empty;
+    };
+
+    std::vector<Entry> entries = std::vector<Entry>(16);
+    std::size_t used = 0;
+    std::size_t live = 0;
+
+    static std::uint64_t hashName(std::string_view name) {
+        return std::hash<std::string_view>{}(name);
+    }
+
+    [[nodiscard]] std::size_t mask() const {
+        return entries.size() - 1;
+    }
+
+    void insert(std::uint64_t hash, std::size_t slot) {
+        std::size_t position = hash & mask();
+        while (entries[position].slot != Empty && entries[position].slot != Deleted) {
+            position = (position + 1) & mask();
+        }
+        if (entries[position].slot == Empty) {
+            ++used;
+        }
+        entries[position] = {hash, slot};
+        ++live;
+    }
+
+    void resize(std::size_t capacity) {
+        std::vector<Entry> previous = std::exchange(entries, std::vector<Entry>(capacity));
+        used = 0;
+        live = 0;
+        for (const Entry& entry : previous) {
+            if (entry.slot != Empty && entry.slot != Deleted) {
+                insert(entry.hash, entry.slot);
+            }
+        }
+    }
+
+    template <typename Storage>
+    std::size_t probe(const Storage& storage, std::string_view name, std::uint64_t hash,
+                      std::size_t position) const {
+        for (;; position = (position + 1) & mask()) {
+            const Entry& entry = entries[position];
+            if (entry.slot == Empty) {
+                return NotFound;
+            }
+            if (entry.slot != Deleted && entry.hash == hash && storage.name(entry.slot) == name) {
+                return entry.slot;
+            }
+        }
+    }
+
+public:
+    static constexpr bool enabled = true;
+
+    void add(std::string_view name, std::size_t slot) {
+        if ((used + 1) * 10 > entries.size() * 7) {
+            resize(std::max<std::size_t>(16, std::bit_ceil((live + 1) * 2)));
+        }
+        insert(hashName(name), slot);
+    }
+
+    void remove(std::string_view name, std::size_t slot) {
+        const std::uint64_t hash = hashName(name);
+        for (std::size_t position = hash & mask(); entries[position].slot != Empty;
+             position = (position + 1) & mask()) {
+            if (entries[position].slot == slot) {
+                entries[position].slot = Deleted;
+                --live;
+                return;
+            }
+        }
+    }
+
+    template <typename Storage>
+    void rebuild(const Storage& storage) {
+        entries.assign(std::max<std::size_t>(16, std::bit_ceil(storage.size() * 2 + 1)), Entry{});
+        used = 0;
+        live = 0;
+        for (std::size_t i = 0; i < storage.size(); ++i) {
+            insert(hashName(storage.name(i)), i);
+        }
+    }
+
+    // Calls fn(slot) for every slot holding this name.
+    template <typename Storage, typename Fn>
+    void find(const Storage& storage, std::string_view name, Fn fn) const {
+        const std::uint64_t hash = hashName(name);
+        for (std::size_t position = hash & mask(); entries[position].slot != Empty;
+             position = (position + 1) & mask()) {
+            const Entry& entry = entries[position];
+            if (entry.slot != Deleted && entry.hash == hash && storage.name(entry.slot) == name) {
+                fn(static_cast<std::size_t>(entry.slot));
+            }
+        }
+    }
+
+    // Resolves a batch of names to their first slot (or NotFound). Keys go through in groups:
+    // hash the group and prefetch every home bucket first, then probe, so the cache misses of
+    // one group overlap instead of being paid one key at a time.
+    template <typename Storage>
+    void findMany(const Storage& storage, std::span<const std::string_view> names,
+                  std::span<std::size_t> slots) const {
+        std::array<std::uint64_t, PrefetchGroup> hashes{};
+        for (std::size_t begin = 0; begin < names.size(); begin += PrefetchGroup) {
+            const std::size_t count = std::min(PrefetchGroup, names.size() - begin);
+            for (std::size_t i = 0; i < count; ++i) {
+                hashes[i] = hashName(names[begin + i]);
+                prefetchRead(&entries[hashes[i] & mask()]);
+            }
+            for (std::size_t i = 0; i < count; ++i) {
+                slots[begin + i] = probe(storage, names[begin + i], hashes[i], hashes[i] & mask());
+            }
+        }
+    }
+};
+
+// Live and dead slots per kind, in slot order, so a kind-filtered query skips every other kind.
+// Dead slots are filtered by the caller and dropped on the next rebuild.
+class KindPostings {
+private:
+    std::array<std::vector<std::uint32_t>, AnimalKindCount> postings;
+
+public:
+    void add(AnimalKind kind, std::size_t slot) {
+        postings[static_cast<std::size_t>(kind)].push_back(static_cast<std::uint32_t>(slot));
+    }
+
+    template <typename Storage>
+    void rebuild(const Storage& storage) {
+        for (auto& slots : postings) {
+            slots.clear();
+        }
+        for (std::size_t i = 0; i < storage.size(); ++i) {
+            add(storage.kind(i), i);
+        }
+    }
+
+    [[nodiscard]] std::span<const std::uint32_t> of(AnimalKind kind) const {
+        return postings[static_cast<std::size_t>(kind)];
+    }
+};
+
+// Slots ordered by name, so a prefix query is a binary search plus a walk over the matching run.
+// Slots added since the last merge wait in a short unsorted tail that lookups scan; it is merged in
+// once it reaches a sixteenth of the sorted part. Like KindPostings, it keeps dead slots until the
+// next rebuild.
+class NamePrefixIndex {
+private:
+    std::vector<std::uint32_t> sorted;
+    std::vector<std::uint32_t> tail;
+
+    template <typename Storage>
+    static auto byName(const Storage& storage) {
+        return [&storage](std::uint32_t a, std::uint32_t b) { return storage.name(a) < storage.name(b); };
+    }
+
+public:
+    template <typename Storage>
+    void add(const Storage& storage, std::size_t slot) {
+        tail.push_back(static_cast<std::uint32_t>(slot));
+        if (tail.size() >= std::max<std::size_t>(1024, sorted.size() / 16)) {
+            std::ranges::sort(tail, byName(storage));
+            const std::size_t middle = sorted.size();
+            sorted.insert(sorted.end(), tail.begin(), tail.end());
+            std::inplace_merge(sorted.begin(), sorted.begin() + static_cast<std::ptrdiff_t>(middle), sorted.end(),
+                               byName(storage));
+            tail.clear();
+        }
+    }
+
+    template <typename Storage>
+    void rebuild(const Storage& storage) {
+        tail.clear();
+        std::vector<std::size_t> slots(storage.size());
+        for (std::size_t i = 0; i < slots.size(); ++i) {
+            slots[i] = i;
+        }
+        const std::vector<std::size_t> order = sortOrderByTypeAndName(
+            slots, [](std::size_t) { return AnimalKind{}; },
+            [&storage](std::size_t slot) { return storage.name(slot); });
+        sorted.assign(order.begin(), order.end());
+    }
+
+    // Calls fn(slot) for every slot whose name starts with prefix, in no particular order.
+    template <typename Storage, typename Fn>
+    void find(const Storage& storage, std::string_view prefix, Fn fn) const {
+        auto it = std::ranges::lower_bound(sorted, prefix, std::less<>{},
+                                           [&storage](std::uint32_t slot) { return storage.name(slot); });
+        for (; it != sorted.end() && storage.name(*it).starts_with(prefix); ++it) {
+            fn(static_cast<std::size_t>(*it));
+        }
+        for (std::uint32_t slot : tail) {
+            if (storage.name(slot).starts_with(prefix)) {
+                fn(static_cast<std::size_t>(slot));
+            }
+        }
+    }
+};
+
+// Readiness of one index that may be built in the background. Queries that would use the index
+// scan instead until ready is set, and count themselves as fallbacks.
+struct IndexReadiness {
+    std::string_view name;
+    std::atomic<bool> ready{true};
+    std::chrono::steady_clock::time_point started{};
+    std::atomic<std::int64_t> buildMicros{0};
+    mutable std::atomic<std::uint64_t> fallbacks{0};
+
+    [[nodiscard]] bool use() const {
+        if (ready.load(std::memory_order_acquire)) {
+            return true;
+        }
+        fallbacks.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    void begin() {
+        started = std::chrono::steady_clock::now();
+        ready.store(false, std::memory_order_relaxed);
+    }
+
+    void finish() {
+        const auto elapsed = std::chrono::steady_clock::now() - started;
+        buildMicros.store(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+        ready.store(true, std::memory_order_release);
+    }
+
+    void report() const {
+        LogLine() << "  " << name << " index: "
+                  << (ready.load(std::memory_order_acquire) ? "ready" : "building") << ", last build "
+                  << buildMicros.load() << " us, " << fallbacks.load() << " queries scanned while building";
+    }
+};
+
+// Runs coroutines on a fixed pool of worker threads. A suspended coroutine costs its frame and a queue
+// entry rather than a thread, so thousands of logical operations can be in flight at once; timers
+// resume a coroutine once its deadline passes without parking a worker on it.
+class CoroutineScheduler {
+private:
+    struct Timer {
+        std::chrono::steady_clock::time_point due;
+        std::uint64_t sequence;
+        std::coroutine_handle<> handle;
+
+        // Heap order: the earliest deadline, then the earliest armed, on top.
+        bool operator<(const Timer& other) const {
+            return std::tie(due, sequence) > std::tie(other.due, other.sequence);
+        }
+    };
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<std::coroutine_handle<>> ready;
+    std::vector<Timer> timers;
+    std::uint64_t nextTimer = 0;
+    bool stopping = false;
+    std::size_t peakQueued = 0;
+    std::atomic<std::uint64_t> resumed{0};
+    std::vector<std::thread> workers;
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping) {
+            const auto now = std::chrono::steady_clock::now();
+            while (!timers.empty() && timers.front().due <= now) {
+                std::pop_heap(timers.begin(), timers.end());
+                ready.push_back(timers.back().handle);
+                timers.pop_back();
+            }
+            if (!ready.empty()) {
+                const std::coroutine_handle<> handle = ready.front();
+                ready.pop_front();
+                lock.unlock();
+                resumed.fetch_add(1, std::memory_order_relaxed);
+                handle.resume();
+                lock.lock();
+            } else if (!timers.empty()) {
+                // By value: wait_until reads the deadline again after waking, and a timer armed
+                // meanwhile may have reallocated the heap.
+                const auto due = timers.front().due;
+                wake.wait_until(lock, due);
+            } else {
+                wake.wait(lock);
+            }
+        }
+    }
+
+    CoroutineScheduler() {
+        const std::size_t count = std::max<std::size_t>(2, std::thread::hardware_concurrency());
+        for (std::size_t i = 0; i < count; ++i) {
+            workers.emplace_back([this] { run(); });
+        }
+    }
+
+public:
+    static CoroutineScheduler& instance() {
+        static CoroutineScheduler scheduler;
+        return scheduler;
+    }
+
+    CoroutineScheduler(const CoroutineScheduler&) = delete;
+    CoroutineScheduler& operator=(const CoroutineScheduler&) = delete;
+
+    void post(std::coroutine_handle<> handle) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ready.push_back(handle);
+            peakQueued = std::max(peakQueued, ready.size());
+        }
+        wake.notify_one();
+    }
+
+    // co_await schedule() moves the awaiting coroutine onto a worker, behind whatever is already queued.
+    [[nodiscard]] auto schedule() {
+        struct Awaiter {
+            CoroutineScheduler& scheduler;
+
+            bool await_ready() const noexcept {
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<> handle) {
+                scheduler.post(handle);
+            }
+
+            void await_resume() const noexcept {}
+        };
+        return Awaiter{*this};
+    }
+
+    [[nodiscard]] auto sleepFor(std::chrono::steady_clock::duration delay) {
+        struct Awaiter {
+            CoroutineScheduler& scheduler;
+            std::chrono::steady_clock::time_point due;
+
+            bool await_ready() const noexcept {
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<> handle) {
+                {
+                    std::lock_guard<std::mutex> lock(scheduler.mutex);
+                    scheduler.timers.push_back({due, scheduler.nextTimer++, handle});
+                    std::push_heap(scheduler.timers.begin(), scheduler.timers.end());
+                }
+                scheduler.wake.notify_all();
+            }
+
+            void await_resume() const noexcept {}
+        };
+        return Awaiter{*this, std::chrono::steady_clock::now() + delay};
+    }
+
+    void reportMetrics() {
+        std::lock_guard<std::mutex> lock(mutex);
+        LogLine() << "Coroutine scheduler: " << workers.size() << " workers, " << resumed.load() << " resumptions, "
+                  << ready.size() << " queued (peak " << peakQueued << "), " << timers.size() << " timers pending";
+    }
+
+    ~CoroutineScheduler() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+};
+
+template <typename T = void>
+class Task;
+
+struct TaskPromiseBase {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+
+    // Hands the thread to whoever awaited the task; symmetric transfer keeps long await chains off the stack.
+    struct FinalAwaiter {
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+            const std::coroutine_handle<> next = handle.promise().continuation;
+            return next ? next : std::noop_coroutine();
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    std::suspend_always initial_suspend() const noexcept {
+        return {};
+    }
+
+    FinalAwaiter final_suspend() const noexcept {
+        return {};
+    }
+
+    void unhandled_exception() noexcept {
+        error = std::current_exception();
+    }
+};
+
+template <typename T>
+struct TaskPromise : TaskPromiseBase {
+    std::optional<T> value;
+
+    Task<T> get_return_object() noexcept;
+
+    void return_value(T result) {
+        value.emplace(std::move(result));
+    }
+
+    T result() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return std::move(*value);
+    }
+};
+
+template <>
+struct TaskPromise<void> : TaskPromiseBase {
+    Task<void> get_return_object() noexcept;
+
+    void return_void() const noexcept {}
+
+    void result() const {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+// A lazily started coroutine: nothing runs until it is awaited, and it finishes on whichever thread
+// its last suspension resumed on. Awaiting it yields its result or rethrows its exception.
+template <typename T>
+class Task {
+public:
+    using promise_type = TaskPromise<T>;
+
+private:
+    std::coroutine_handle<promise_type> handle;
+
+public:
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+    Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (handle) {
+                handle.destroy();
+            }
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+
+    T await_resume() {
+        return handle.promise().result();
+    }
+
+    ~Task() {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+};
+
+template <typename T>
+Task<T> TaskPromise<T>::get_return_object() noexcept {
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() noexcept {
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+// An eagerly started coroutine that frees itself when done; the glue under blockOn, spawn and whenAll.
+struct DetachedTask {
+    struct promise_type {
+        DetachedTask get_return_object() const noexcept {
+            return {};
+        }
+
+        std::suspend_never initial_suspend() const noexcept {
+            return {};
+        }
+
+        std::suspend_never final_suspend() const noexcept {
+            return {};
+        }
+
+        void return_void() const noexcept {}
+
+        void unhandled_exception() const noexcept {
+            std::terminate();
+        }
+    };
+};
+
+// Runs a task on the scheduler and blocks the calling thread until it finishes; the bridge from
+// ordinary code such as the menu loop.
+template <typename T>
+T blockOn(Task<T> task) {
+    std::mutex mutex;
+    std::condition_variable finished;
+    bool done = false;
+    std::optional<std::conditional_t<std::is_void_v<T>, bool, T>> value;
+    std::exception_ptr error;
+    // The task's frame is destroyed before the caller is woken, so nothing of it outlives blockOn.
+    [](Task<T> task, auto& mutex, auto& finished, bool& done, auto& value, auto& error) -> DetachedTask {
+        co_await CoroutineScheduler::instance().schedule();
+        try {
+            Task<T> running = std::move(task);
+            if constexpr (std::is_void_v<T>) {
+                co_await running;
+                value.emplace(true);
+            } else {
+                value.emplace(co_await running);
+            }
+        } catch (...) {
+            error = std::current_exception();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+        finished.notify_one();
+    }(std::move(task), mutex, finished, done, value, error);
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [&done] { return done; });
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    if constexpr (!std::is_void_v<T>) {
+        return std::move(*value);
+    }
+}
+
+// Fire and forget: the task runs on the scheduler, and an exception it lets escape is logged.
+inline void spawn(Task<void> task) {
+    [](Task<void> task) -> DetachedTask {
+        co_await CoroutineScheduler::instance().schedule();
+        try {
+            co_await task;
+        } catch (const std::exception& e) {
+            DiagnosticLine() << "Background task failed: " << e.what();
+        }
+    }(std::move(task));
+}
+
+// Spawned tasks that their owner waits for before the state they use goes away; the destructor waits
+// for any still running.
+class TaskGroup {
+private:
+    std::mutex mutex;
+    std::condition_variable idle;
+    std::size_t running = 0;
+
+    void leave() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--running == 0) {
+            idle.notify_all();
+        }
+    }
+
+public:
+    TaskGroup() = default;
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    void spawn(Task<void> task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++running;
+        }
+        ::spawn([](TaskGroup& group, Task<void> task) -> Task<void> {
+            struct Leave {
+                TaskGroup& group;
+                ~Leave() {
+                    group.leave();
+                }
+            } leave{group};
+            co_await task;
+        }(*this, std::move(task)));
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this] { return running == 0; });
+    }
+
+    ~TaskGroup() {
+        wait();
+    }
+};
+
+// Starts every task on the scheduler at once and resumes the caller when the last one finishes,
+// rethrowing the first exception any of them raised.
+inline Task<void> whenAll(std::vector<Task<void>> tasks) {
+    struct Join {
+        std::atomic<std::size_t> pending{0};
+        std::coroutine_handle<> waiter;
+        std::mutex mutex;
+        std::exception_ptr error;
+
+        void finish() {
+            if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                CoroutineScheduler::instance().post(waiter);
+            }
+        }
+    };
+
+    struct Awaiter {
+        std::vector<Task<void>>& tasks;
+        Join join;
+
+        bool await_ready() const noexcept {
+            return tasks.empty();
+        }
+
+        bool await_suspend(std::coroutine_handle<> handle) {
+            join.waiter = handle;
+            // One extra count for this call, so tasks that finish before the loop ends cannot resume
+            // the caller early.
+            join.pending.store(tasks.size() + 1, std::memory_order_relaxed);
+            for (Task<void>& task : tasks) {
+                [](Task<void> task, Join& join) -> DetachedTask {
+                    co_await CoroutineScheduler::instance().schedule();
+                    try {
+                        Task<void> running = std::move(task);
+                        co_await running;
+                    } catch (...) {
+                        std::lock_guard<std::mutex> lock(join.mutex);
+                        if (!join.error) {
+                            join.error = std::current_exception();
+                        }
+                    }
+                    join.finish();
+                }(std::move(task), join);
+            }
+            return join.pending.fetch_sub(1, std::memory_order_acq_rel) != 1;
+        }
+
+        void await_resume() {
+            if (join.error) {
+                std::rethrow_exception(join.error);
+            }
+        }
+    };
+
+    co_await Awaiter{tasks, {}};
+}
+
+// Reader/writer turns for coroutines: waiting suspends the coroutine instead of blocking its worker,
+// and turns are granted in arrival order, so a queued writer is not starved by a stream of readers.
+// Unlike a std::shared_mutex, a turn may be held across suspensions and released on another thread.
+class AsyncSharedMutex {
+private:
+    struct Waiter {
+        std::coroutine_handle<> handle;
+        bool shared;
+    };
+
+    std::mutex mutex;
+    std::deque<Waiter> waiters;
+    std::size_t readers = 0;
+    bool writer = false;
+
+    [[nodiscard]] bool admits(bool shared) const {
+        return waiters.empty() && !writer && (shared || readers == 0);
+    }
+
+    void grant(bool shared) {
+        if (shared) {
+            ++readers;
+        } else {
+            writer = true;
+        }
+    }
+
+    void release(bool shared) {
+        std::vector<std::coroutine_handle<>> woken;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (shared) {
+                --readers;
+            } else {
+                writer = false;
+            }
+            while (!waiters.empty() && !writer && (waiters.front().shared || readers == 0)) {
+                grant(waiters.front().shared);
+                woken.push_back(waiters.front().handle);
+                waiters.pop_front();
+            }
+        }
+        for (const auto handle : woken) {
+            CoroutineScheduler::instance().post(handle);
+        }
+    }
+
+public:
+    class Turn {
+    private:
+        AsyncSharedMutex* owner;
+        bool shared;
+
+    public:
+        Turn(AsyncSharedMutex& owner, bool shared) : owner(&owner), shared(shared) {}
+
+        Turn(Turn&& other) noexcept : owner(std::exchange(other.owner, nullptr)), shared(other.shared) {}
+
+        Turn(const Turn&) = delete;
+        Turn& operator=(const Turn&) = delete;
+        Turn& operator=(Turn&&) = delete;
+
+        ~Turn() {
+            if (owner != nullptr) {
+                owner->release(shared);
+            }
+        }
+    };
+
+    // co_await lock(shared) resumes holding a Turn; a suspended waiter resumes on a scheduler worker.
+    [[nodiscard]] auto lock(bool shared) {
+        struct Awaiter {
+            AsyncSharedMutex& owner;
+            bool shared;
+
+            bool await_ready() const noexcept {
+                return false;
+            }
+
+            bool await_suspend(std::coroutine_handle<> handle) {
+                std::lock_guard<std::mutex> lock(owner.mutex);
+                if (owner.admits(shared)) {
+                    owner.grant(shared);
+                    return false;
+                }
+                owner.waiters.push_back({handle, shared});
+                return true;
+            }
+
+            Turn await_resume() const noexcept {
+                return Turn(owner, shared);
+            }
+        };
+        return Awaiter{*this, shared};
+    }
+};
+
+struct NullLock {};
+
+class NullSync {
+public:
+    static constexpr bool threadSafe = false;
+
+    [[nodiscard]] NullLock read() const {
+        return {};
+    }
+
+    [[nodiscard]] NullLock write() const {
+        return {};
+    }
+
+    [[nodiscard]] NullLock cache() const {
+        return {};
+    }
+};
+
+class SharedMutexSync {
+private:
+    mutable std::shared_mutex mutex;
+    mutable std::mutex cacheMutex;
+public:
+    static constexpr bool threadSafe = true;
+
+    [[nodiscard]] std::shared_lock<std::shared_mutex> read() const {
+        return std::shared_lock<std::shared_mutex>(mutex);
+    }
+
+    [[nodiscard]] std::unique_lock<std::shared_mutex> write() const {
+        return std::unique_lock<std::shared_mutex>(mutex);
+    }
+
+    [[nodiscard]] std::unique_lock<std::mutex> cache() const {
+        return std::unique_lock<std::mutex>(cacheMutex);
+    }
+};
+
+// Readers take the shard picked by their thread id, shared, so readers that hash to the same shard
+// still run together; writers take every shard exclusively, in order.
+template <std::size_t Shards>
+class ShardedSync {
+private:
+    struct alignas(64) Shard {
+        std::shared_mutex mutex;
+    };
+
+    mutable std::array<Shard, Shards> shards;
+    mutable std::mutex cacheMutex;
+
+    class AllShardsLock {
+    private:
+        std::array<Shard, Shards>* shards;
+    public:
+        explicit AllShardsLock(std::array<Shard, Shards>& shards) : shards(&shards) {
+            for (auto& shard : shards) {
+                shard.mutex.lock();
+            }
+        }
+
+        AllShardsLock(AllShardsLock&& other) noexcept : shards(std::exchange(other.shards, nullptr)) {}
+
+        AllShardsLock(const AllShardsLock&) = delete;
+        AllShardsLock& operator=(const AllShardsLock&) = delete;
+
+        ~AllShardsLock() {
+            if (shards != nullptr) {
+                for (auto& shard : *shards) {
+                    shard.mutex.unlock();
+                }
+            }
+        }
+    };
+
+public:
+    static constexpr bool threadSafe = true;
+
+    [[nodiscard]] std::shared_lock<std::shared_mutex> read() const {
+        const std::size_t shard = std::hash<std::thread::id>{}(std::this_thread::get_id()) % Shards;
+        return std::shared_lock<std::shared_mutex>(shards[shard].mutex);
+    }
+
+    [[nodiscard]] AllShardsLock write() const {
+        return AllShardsLock(shards);
+    }
+
+    [[nodiscard]] std::unique_lock<std::mutex> cache() const {
+        return std::unique_lock<std::mutex>(cacheMutex);
+    }
+};
+
+// One bit per storage slot; a cleared bit is a tombstone. Scans walk set bits a word at a time.
+class ValidityBitmap {
+private:
+    std::vector<std::uint64_t> words;
+    std::size_t count = 0;
+    std::size_t dead = 0;
+public:
+    [[nodiscard]] std::size_t size() const {
+        return count;
+    }
+
+    [[nodiscard]] std::size_t tombstones() const {
+        return dead;
+    }
+
+    [[nodiscard]] bool test(std::size_t slot) const {
+        return (words[slot / 64] >> (slot % 64)) & 1u;
+    }
+
+    // Number of live slots before this one, i.e. its position in display order.
+    [[nodiscard]] std::size_t rank(std::size_t slot) const {
+        std::size_t before = 0;
+        for (std::size_t word = 0; word < slot / 64; ++word) {
+            before += static_cast<std::size_t>(std::popcount(words[word]));
+        }
+        const std::uint64_t below = (std::uint64_t{1} << (slot % 64)) - 1;
+        return before + static_cast<std::size_t>(std::popcount(words[slot / 64] & below));
+    }
+
+    void push() {
+        if (count % 64 == 0) {
+            words.push_back(0);
+        }
+        words.back() |= std::uint64_t{1} << (count % 64);
+        ++count;
+    }
+
+    void clear(std::size_t slot) {
+        words[slot / 64] &= ~(std::uint64_t{1} << (slot % 64));
+        ++dead;
+    }
+
+    void reset(std::size_t slots) {
+        words.assign((slots + 63) / 64, ~std::uint64_t{0});
+        if (slots % 64 != 0) {
+            words.back() = (std::uint64_t{1} << (slots % 64)) - 1;
+        }
+        count = slots;
+        dead = 0;
+    }
+
+    [[nodiscard]] std::vector<bool> keepMask() const {
+        std::vector<bool> keep(count);
+        for (std::size_t i = 0; i < count; ++i) {
+            keep[i] = test(i);
+        }
+        return keep;
+    }
+
+    // Like forEachLive, but stops as soon as fn returns false.
+    template <typename Fn>
+    void forEachLiveUntil(Fn fn) const {
+        for (std::size_t word = 0; word < words.size(); ++word) {
+            for (std::uint64_t bits = words[word]; bits != 0; bits &= bits - 1) {
+                if (!fn(word * 64 + static_cast<std::size_t>(std::countr_zero(bits)))) {
+                    return;
+                }
+            }
+        }
+    }
+
+    template <typename Fn>
+    void forEachLive(Fn fn) const {
+        for (std::size_t word = 0; word < words.size(); ++word) {
+            for (std::uint64_t bits = words[word]; bits != 0; bits &= bits - 1) {
+                fn(word * 64 + static_cast<std::size_t>(std::countr_zero(bits)));
+            }
+        }
+    }
+
+    // Like forEachLive, restricted to slots in [first, last).
+    template <typename Fn>
+    void forEachLiveIn(std::size_t first, std::size_t last, Fn fn) const {
+        for (std::size_t word = first / 64; word < words.size() && word * 64 < last; ++word) {
+            std::uint64_t bits = words[word];
+            if (word == first / 64) {
+                bits &= ~std::uint64_t{0} << (first % 64);
+            }
+            if ((word + 1) * 64 > last) {
+                bits &= (std::uint64_t{1} << (last % 64)) - 1;
+            }
+            for (; bits != 0; bits &= bits - 1) {
+                fn(word * 64 + static_cast<std::size_t>(std::countr_zero(bits)));
+            }
+        }
+    }
+};
+
+// One bit per page of SlotsPerPage storage slots, set when anything in the page changed since the
+// last checkpoint, so a snapshot can rewrite just those pages.
+class DirtyPageMap {
+private:
+    std::vector<std::uint64_t> words;
+
+public:
+    static constexpr std::size_t SlotsPerPage = 256;
+
+    [[nodiscard]] static std::size_t pagesFor(std::size_t slots) {
+        return (slots + SlotsPerPage - 1) / SlotsPerPage;
+    }
+
+    [[nodiscard]] bool test(std::size_t page) const {
+        return page / 64 < words.size() && ((words[page / 64] >> (page % 64)) & 1u);
+    }
+
+    [[nodiscard]] std::size_t count() const {
+        std::size_t dirty = 0;
+        for (std::uint64_t word : words) {
+            dirty += static_cast<std::size_t>(std::popcount(word));
+        }
+        return dirty;
+    }
+
+    void mark(std::size_t slot) {
+        const std::size_t page = slot / SlotsPerPage;
+        if (page / 64 >= words.size()) {
+            words.resize(page / 64 + 1);
+        }
+        words[page / 64] |= std::uint64_t{1} << (page % 64);
+    }
+
+    // Marks every page holding a slot in [first, last).
+    void markRange(std::size_t first, std::size_t last) {
+        for (std::size_t page = first / SlotsPerPage; page < pagesFor(last); ++page) {
+            mark(page * SlotsPerPage);
+        }
+    }
+
+    void clear() {
+        std::ranges::fill(words, 0);
+    }
+};
+
+// Change events, batched per command. Positions index the container's display order at the moment the
+// event applies: Added inserts at its position, Removed lists ascending pre-removal positions, and
+// Reordered spells the new order as runs of consecutive old positions, so an already sorted
+// container costs one run.
+struct AnimalAdded {
+    std::uint32_t position;
+    std::shared_ptr<Animal> animal;
+};
+
+struct AnimalsRemoved {
+    std::vector<std::uint32_t> positions;
+};
+
+struct AnimalsReordered {
+    struct Run {
+        std::uint32_t from;
+        std::uint32_t length;
+    };
+    std::vector<Run> runs;
+};
+
+using AnimalChange = std::variant<AnimalAdded, AnimalsRemoved, AnimalsReordered>;
+
+// Collects a container's change events until the caller takes them. Disabled by default so bulk
+// loads that nobody observes do not queue events.
+class AnimalChangeLog {
+private:
+    bool tracking = false;
+    std::vector<AnimalChange> pending;
+public:
+    void track(bool on) {
+        tracking = on;
+        if (!on) {
+            pending.clear();
+        }
+    }
+
+    [[nodiscard]] bool enabled() const {
+        return tracking;
+    }
+
+    void added(std::size_t position, const std::shared_ptr<Animal>& animal) {
+        if (tracking) {
+            pending.emplace_back(AnimalAdded{static_cast<std::uint32_t>(position), animal});
+        }
+    }
+
+    void removed(std::vector<std::uint32_t> positions) {
+        if (tracking && !positions.empty()) {
+            pending.emplace_back(AnimalsRemoved{std::move(positions)});
+        }
+    }
+
+    void reordered(std::span<const std::size_t> order) {
+        if (!tracking) {
+            return;
+        }
+        AnimalsReordered event;
+        for (std::size_t i = 0; i < order.size(); ++i) {
+            if (i != 0 && order[i] == order[i - 1] + 1) {
+                ++event.runs.back().length;
+            } else {
+                event.runs.push_back({static_cast<std::uint32_t>(order[i]), 1});
+            }
+        }
+        if (event.runs.size() > 1 || (event.runs.size() == 1 && event.runs.front().from != 0)) {
+            pending.emplace_back(std::move(event));
+        }
+    }
+
+    // For changes produced elsewhere, such as batches forwarded from a partition worker.
+    void record(AnimalChange change) {
+        if (tracking) {
+            pending.push_back(std::move(change));
+        }
+    }
+
+    [[nodiscard]] std::vector<AnimalChange> take() {
+        return std::exchange(pending, {});
+    }
+};
+
+class AnimalContainerBase {
+protected:
+    static int instanceCount;
+public:
+    static void showInstanceCount() {
+        LogLine() << "Total AnimalContainer instances: " << instanceCount;
+    }
+};
+
+int AnimalContainerBase::instanceCount = 0;
+
+template <typename StoragePolicy, typename IndexPolicy, typename SyncPolicy>
+class BasicAnimalContainer : public AnimalContainerBase {
+public:
+    static constexpr bool syncIsThreadSafe = SyncPolicy::threadSafe;
+
+private:
+    // Byte range of a pre-rendered line inside renderBuffer, valid while version matches the slot's.
+    struct RenderedLine {
+        std::size_t offset = 0;
+        std::size_t length = 0;
+        std::uint64_t version = 0;
+    };
+
+    struct SlotLines {
+        RenderedLine display;
+        RenderedLine info;
+    };
+
+    StoragePolicy storage;
+    IndexPolicy index;
+    SyncPolicy sync;
+    ValidityBitmap live;
+    double purgeThreshold = 0.25;
+    std::uint64_t purges = 0;
+    std::uint64_t nextVersion = 1;
+    mutable std::vector<SlotLines> lines;
+    mutable std::string renderBuffer;
+    mutable std::size_t renderGarbage = 0;
+    QueryResultCache::Versions kindVersions{};
+    mutable QueryResultCache queryCache;
+    AnimalChangeLog changes;
+    DirtyPageMap dirtyPages;
+    KindPostings kindPostings;
+    NamePrefixIndex prefixIndex;
+    IndexReadiness nameReady{"name"};
+    IndexReadiness kindReady{"kind"};
+    IndexReadiness prefixReady{"prefix"};
+    std::vector<std::thread> indexBuilders;
+    mutable AsyncSharedMutex asyncTurns;
+
+    static RenderedLine& select(SlotLines& slot, RenderTarget target) {
+        return target == RenderTarget::Display ? slot.display : slot.info;
+    }
+
+    // Groups stale slots by kind so every kind's batch kernel runs once per refresh.
+    void refresh(RenderTarget target, std::optional<AnimalKind> only) const {
+        std::array<std::vector<std::size_t>, AnimalKindCount> stale;
+        live.forEachLive([&](std::size_t i) {
+            const AnimalKind kind = storage.kind(i);
+            if ((!only || kind == *only) && select(lines[i], target).version != storage.version(i)) {
+                stale[static_cast<std::size_t>(kind)].push_back(i);
+            }
+        });
+        std::vector<std::size_t> ends;
+        for (std::size_t kind = 0; kind < AnimalKindCount; ++kind) {
+            if (stale[kind].empty()) {
+                continue;
+            }
+            ends.resize(stale[kind].size());
+            std::size_t begin = renderBuffer.size();
+            storage.renderBatch(static_cast<AnimalKind>(kind), target, stale[kind], renderBuffer, ends);
+            for (std::size_t i = 0; i < ends.size(); ++i) {
+                const std::size_t slot = stale[kind][i];
+                RenderedLine& line = select(lines[slot], target);
+                renderGarbage += line.length;
+                line = {begin, ends[i] - begin, storage.version(slot)};
+                begin = ends[i];
+            }
+        }
+    }
+
+    void compactRenderBuffer() const {
+        if (renderGarbage * 2 <= renderBuffer.size()) {
+            return;
+        }
+        std::string compacted;
+        compacted.reserve(renderBuffer.size() - renderGarbage);
+        for (auto& slot : lines) {
+            for (RenderedLine* line : {&slot.display, &slot.info}) {
+                if (line->version == 0) {
+                    continue;
+                }
+                const std::size_t offset = compacted.size();
+                compacted.append(renderBuffer, line->offset, line->length);
+                line->offset = offset;
+            }
+        }
+        renderBuffer = std::move(compacted);
+        renderGarbage = 0;
+    }
+
+    // Caller holds the cache lock.
+    std::string render(RenderTarget target, std::optional<AnimalKind> only) const {
+        refresh(target, only);
+        compactRenderBuffer();
+        std::size_t total = 0;
+        live.forEachLive([&](std::size_t i) {
+            if (!only || storage.kind(i) == *only) {
+                total += select(lines[i], target).length;
+            }
+        });
+        std::string out;
+        out.reserve(total);
+        live.forEachLive([&](std::size_t i) {
+            if (!only || storage.kind(i) == *only) {
+                const RenderedLine& line = select(lines[i], target);
+                out.append(renderBuffer.data() + line.offset, line.length);
+            }
+        });
+        return out;
+    }
+
+    void touchKind(AnimalKind kind) {
+        ++kindVersions[static_cast<std::size_t>(kind)];
+    }
+
+    void touchAllKinds() {
+        for (auto& version : kindVersions) {
+            ++version;
+        }
+    }
+
+    void tombstone(std::size_t slot) {
+        touchKind(storage.kind(slot));
+        dirtyPages.mark(slot);
+        live.clear(slot);
+        index.remove(storage.name(slot), slot);
+        renderGarbage += lines[slot].display.length + lines[slot].info.length;
+        lines[slot] = SlotLines{};
+    }
+
+    // Index builders read storage without locks, so every writer waits for them first.
+    void awaitIndexes() {
+        for (std::thread& builder : indexBuilders) {
+            builder.join();
+        }
+        indexBuilders.clear();
+    }
+
+    [[nodiscard]] bool indexesBuilding() const {
+        return !nameReady.ready.load(std::memory_order_acquire) || !kindReady.ready.load(std::memory_order_acquire) ||
+               !prefixReady.ready.load(std::memory_order_acquire);
+    }
+
+    void buildIndexesInBackground() {
+        nameReady.begin();
+        kindReady.begin();
+        prefixReady.begin();
+        indexBuilders.emplace_back([this] {
+            index.rebuild(storage);
+            nameReady.finish();
+        });
+        indexBuilders.emplace_back([this] {
+            kindPostings.rebuild(storage);
+            kindReady.finish();
+        });
+        indexBuilders.emplace_back([this] {
+            prefixIndex.rebuild(storage);
+            prefixReady.finish();
+        });
+    }
+
+    void rebuildIndexes() {
+        index.rebuild(storage);
+        if constexpr (IndexPolicy::enabled) {
+            kindPostings.rebuild(storage);
+            prefixIndex.rebuild(storage);
+        }
+    }
+
+    // Drops tombstoned slots from storage in one pass.
+    void purge() {
+        if (live.tombstones() == 0) {
+            return;
+        }
+        const std::vector<bool> keep = live.keepMask();
+        const auto firstDead = static_cast<std::size_t>(std::ranges::find(keep, false) - keep.begin());
+        storage.retain(keep);
+        dirtyPages.markRange(firstDead, storage.size());
+        retainColumn(lines, keep);
+        live.reset(storage.size());
+        rebuildIndexes();
+        ++purges;
+    }
+
+    void purgeIfNeeded() {
+        if (static_cast<double>(live.tombstones()) > purgeThreshold * static_cast<double>(live.size())) {
+            purge();
+        }
+    }
+
+public:
+    BasicAnimalContainer() {
+        ++instanceCount;
+    }
+
+    BasicAnimalContainer(const BasicAnimalContainer&) = delete;
+    BasicAnimalContainer& operator=(const BasicAnimalContainer&) = delete;
+
+    void addAnimal(const std::shared_ptr<Animal>& animal) {
+        [[maybe_unused]] auto lock = sync.write();
+        awaitIndexes();
+        changes.added(live.size() - live.tombstones(), animal);
+        index.add(animal->getName(), storage.size());
+        touchKind(animal->getKind());
+        dirtyPages.mark(storage.size());
+        storage.push(animal, nextVersion++);
+        lines.emplace_back();
+        live.push();
+        if constexpr (IndexPolicy::enabled) {
+            kindPostings.add(animal->getKind(), storage.size() - 1);
+            prefixIndex.add(storage, storage.size() - 1);
+        }
+    }
+
+    // Bulk load, e.g. a restore: appends without index maintenance, then builds the name, kind and
+    // prefix indexes in parallel on background threads. Queries scan until each index is ready and
+    // switch to it as soon as it is; the next mutation waits for the builds.
+    void addAnimals(std::span<const std::shared_ptr<Animal>> animals) {
+        [[maybe_unused]] auto lock = sync.write();
+        awaitIndexes();
+        purge();
+        storage.reserve(storage.size() + animals.size(), 0);
+        lines.reserve(lines.size() + animals.size());
+        for (const auto& animal : animals) {
+            changes.added(live.size() - live.tombstones(), animal);
+            touchKind(animal->getKind());
+            dirtyPages.mark(storage.size());
+            storage.push(animal, nextVersion++);
+            lines.emplace_back();
+            live.push();
+        }
+        if constexpr (IndexPolicy::enabled) {
+            buildIndexesInBackground();
+        }
+    }
+
+    [[nodiscard]] std::size_t size() const {
+        [[maybe_unused]] auto lock = sync.read();
+        return live.size() - live.tombstones();
+    }
+
+    // Fraction of tombstoned slots that triggers a purge.
+    void setPurgeThreshold(double threshold) {
+        [[maybe_unused]] auto lock = sync.write();
+        awaitIndexes();
+        purgeThreshold = threshold;
+        purgeIfNeeded();
+    }
+
+    // Sizes storage for a bulk load; with prefaulting enabled the columns are populated up front.
+    void reserve(std::size_t count, std::size_t nameBytes = 0) {
+        [[maybe_unused]] auto lock = sync.write();
+        awaitIndexes();
+        storage.reserve(count, nameBytes);
+        lines.reserve(count);
+    }
+
+    [[nodiscard]] std::string renderDisplay() const {
+        [[maybe_unused]] auto lock = sync.read();
+        [[maybe_unused]] auto cacheLock = sync.cache();
+        return render(RenderTarget::Display, std::nullopt);
+    }
+
+    [[nodiscard]] std::string renderInfo(const std::string& type) const {
+        const auto kind = kindFromType(type);
+        if (!kind) {
+            return {};
+        }
+        [[maybe_unused]] auto lock = sync.read();
+        [[maybe_unused]] auto cacheLock = sync.cache();
+        std::string key = "info|" + type;
+        if (const std::string* cached = queryCache.find(key, kindVersions)) {
+            return *cached;
+        }
+        std::string out = render(RenderTarget::Info, kind);
+        queryCache.insert(std::move(key), out, kindVersions, kind);
+        return out;
+    }
+
+    // Rendered query results are cached per normalized query and reused until a kind the query
+    // can return is modified.
+    [[nodiscard]] std::string renderQuery(const QuerySpec& spec) const {
+        std::string key = normalizedQueryKey(spec);
+        [[maybe_unused]] auto lock = sync.read();
+        {
+            [[maybe_unused]] auto cacheLock = sync.cache();
+            if (const std::string* cached = queryCache.find(key, kindVersions)) {
+                return *cached;
+            }
+        }
+        std::string out;
+        executeQueryLocked(spec, [&out](AnimalKind kind, std::string_view name) {
+            appendDisplayRow(out, kind, name);
+        });
+        [[maybe_unused]] auto cacheLock = sync.cache();
+        queryCache.insert(std::move(key), out, kindVersions, spec.kind);
+        return out;
+    }
+
+    void setQueryCacheCapacity(std::size_t bytes) {
+        [[maybe_unused]] auto lock = sync.write();
+        queryCache.setCapacity(bytes);
+    }
+
+    void trackChanges(bool on) {
+        [[maybe_unused]] auto lock = sync.write();
+        changes.track(on);
+    }
+
+    [[nodiscard]] std::vector<AnimalChange> takeChanges() {
+        [[maybe_unused]] auto lock = sync.write();
+        return changes.take();
+    }
+
+    void displayAll() const {
+        std::string out = renderDisplay();
+        if (!out.empty()) {
+            LogSink::instance().write(std::move(out));
+        }
+    }
+
+    void removeAnimal(const std::string& name) {
+        const auto kind = kindFromType(name);
+        if (!kind) {
+            return;
+        }
+        [[maybe_unused]] auto lock = sync.write();
+        awaitIndexes();
+        std::vector<std::uint32_t> positions;
+        std::uint32_t position = 0;
+        live.forEachLive([&](std::size_t i) {
+            if (storage.kind(i) == *kind) {
+                positions.push_back(position);
+                tombstone(i);
+            }
+            ++position;
+        });
+        changes.removed(std::move(positions));
+        purgeIfNeeded();
+    }
+
+    // Removes every animal with this name; returns how many were removed.
+    std::size_t removeAnimalByName(std::string_view name) {
+        [[maybe_unused]] auto lock = sync.write();
+        awaitIndexes();
+        std::vector<std::size_t> matches;
+        if constexpr (IndexPolicy::enabled) {
+            index.find(storage, name, [&matches](std::size_t slot) { matches.push_back(slot); });
+        } else {
+            live.forEachLive([&](std::size_t i) {
+                if (storage.name(i) == name) {
+                    matches.push_back(i);
+                }
+            });
+        }
+        if (changes.enabled()) {
+            std::vector<std::uint32_t> positions;
+            for (std::size_t slot : matches) {
+                positions.push_back(static_cast<std::uint32_t>(live.rank(slot)));
+            }
+            std::ranges::sort(positions);
+            changes.removed(std::move(positions));
+        }
+        for (std::size_t slot : matches) {
+            tombstone(slot);
+        }
+        purgeIfNeeded();
+        return matches.size();
+    }
+
+    void displayAnimalInfo(const std::string& name) const {
+        std::string out = renderInfo(name);
+        if (!out.empty()) {
+            LogSink::instance().write(std::move(out));
+        }
+    }
+
+    [[nodiscard]] std::shared_ptr<Animal> findAnimal(std::string_view name) const {
+        [[maybe_unused]] auto lock = sync.read();
+        if constexpr (IndexPolicy::enabled) {
+            if (nameReady.use()) {
+                std::size_t slot = HashNameIndex::NotFound;
+                const std::string_view key = name;
+                index.findMany(storage, std::span(&key, 1), std::span(&slot, 1));
+                return slot == HashNameIndex::NotFound ? nullptr : storage.animal(slot);
+            }
+        }
+        for (std::size_t i = 0; i < storage.size(); ++i) {
+            if (live.test(i) && storage.name(i) == name) {
+                return storage.animal(i);
+            }
+        }
+        return nullptr;
+    }
+
+    [[nodiscard]] AnimalQuery<BasicAnimalContainer> query() const {
+        return AnimalQuery<BasicAnimalContainer>(*this);
+    }
+
+    // Query planner: a name-equality predicate is answered from the name index, a name prefix from the
+    // prefix index and a kind from the kind postings, each only once built; everything else scans the
+    // live slots. Filtering, ordering and the limit are fused on top.
+    template <typename Emit>
+    void executeQuery(const QuerySpec& spec, Emit emit) const {
+        [[maybe_unused]] auto lock = sync.read();
+        executeQueryLocked(spec, emit);
+    }
+
+    template <typename Emit>
+    void executeQueryLocked(const QuerySpec& spec, Emit emit) const {
+        const auto kindAt = [this](std::size_t slot) { return storage.kind(slot); };
+        const auto nameAt = [this](std::size_t slot) { return storage.name(slot); };
+        if (IndexPolicy::enabled && !spec.nameEquals.empty() && nameReady.use()) {
+            finishQuery(spec, [&](auto visit) {
+                bool more = true;
+                index.find(storage, spec.nameEquals.front(), [&](std::size_t slot) {
+                    more = more && visit(slot);
+                });
+            }, kindAt, nameAt, emit);
+        } else if (IndexPolicy::enabled && !spec.namePrefixes.empty() && prefixReady.use()) {
+            // The longest prefix is the most selective; visiting in slot order keeps display order.
+            const std::string& prefix = *std::ranges::max_element(spec.namePrefixes, {}, &std::string::size);
+            std::vector<std::size_t> slots;
+            prefixIndex.find(storage, prefix, [&](std::size_t slot) {
+                if (live.test(slot)) {
+                    slots.push_back(slot);
+                }
+            });
+            std::ranges::sort(slots);
+            finishQuery(spec, [&slots](auto visit) {
+                for (std::size_t slot : slots) {
+                    if (!visit(slot)) {
+                        return;
+                    }
+                }
+            }, kindAt, nameAt, emit);
+        } else if (IndexPolicy::enabled && spec.kind && kindReady.use()) {
+            finishQuery(spec, [&](auto visit) {
+                for (std::uint32_t slot : kindPostings.of(*spec.kind)) {
+                    if (live.test(slot) && !visit(slot)) {
+                        return;
+                    }
+                }
+            }, kindAt, nameAt, emit);
+        } else {
+            finishQuery(spec, [this](auto visit) { live.forEachLiveUntil(visit); }, kindAt, nameAt, emit);
+        }
+    }
+
+    // Batched findAnimal: with a hash index the probes are pipelined with group prefetching.
+    [[nodiscard]] std::vector<std::shared_ptr<Animal>> lookupMany(std::span<const std::string_view> names) const {
+        std::vector<std::shared_ptr<Animal>> found(names.size());
+        if constexpr (IndexPolicy::enabled) {
+            std::vector<std::size_t> slots(names.size());
+            [[maybe_unused]] auto lock = sync.read();
+            if (nameReady.use()) {
+                index.findMany(storage, names, slots);
+                for (std::size_t i = 0; i < slots.size(); ++i) {
+                    if (slots[i] != HashNameIndex::NotFound) {
+                        found[i] = storage.animal(slots[i]);
+                    }
+                }
+                return found;
+            }
+        }
+        for (std::size_t i = 0; i < names.size(); ++i) {
+            found[i] = findAnimal(names[i]);
+        }
+        return found;
+    }
+
+    // Forks while holding the write lock so the child inherits a quiescent image. The child gets the
+    // page count, which pages to write (all of them when full) and an unlocked per-page scan of that
+    // image, and must end with _exit(); the parent gets the child's pid and starts a fresh dirty set.
+    template <typename Child>
+    int forkSnapshot(bool full, Child child) {
+#if defined(__linux__)
+        [[maybe_unused]] auto lock = sync.write();
+        const std::size_t pageCount = DirtyPageMap::pagesFor(storage.size());
+        std::vector<bool> dirty(pageCount);
+        for (std::size_t page = 0; page < pageCount; ++page) {
+            dirty[page] = full || dirtyPages.test(page);
+        }
+        const pid_t pid = fork();
+        if (pid == 0) {
+            child(pageCount, dirty, [this](std::size_t page, auto emit) {
+                const std::size_t first = page * DirtyPageMap::SlotsPerPage;
+                live.forEachLiveIn(first, std::min(first + DirtyPageMap::SlotsPerPage, storage.size()),
+                                   [&](std::size_t slot) { emit(storage.kind(slot), storage.name(slot)); });
+            });
+        }
+        if (pid > 0) {
+            dirtyPages.clear();
+        }
+        return pid;
+#else
+        (void)child;
+        return -1;
+#endif
+    }
+
+    // Runs compaction slices until the budget is spent; returns whether work remains. Compaction is
+    // deferrable, so while index builds are outstanding it yields rather than holding the write lock
+    // until they finish.
+    bool compactFor(std::chrono::microseconds budget) {
+        constexpr std::size_t slotsPerSlice = 1024;
+        [[maybe_unused]] auto lock = sync.write();
+        if (indexesBuilding()) {
+            return true;
+        }
+        awaitIndexes();
+        const auto deadline = std::chrono::steady_clock::now() + budget;
+        bool more = true;
+        while (more && std::chrono::steady_clock::now() < deadline) {
+            more = storage.compactStep(slotsPerSlice);
+        }
+        return more;
+    }
+
+    void reportMetrics() const {
+        [[maybe_unused]] auto lock = sync.read();
+        storage.reportMetrics();
+        LogLine() << "  tombstones: " << live.tombstones() << " of " << live.size() << " slots, " << purges
+                  << " purges (threshold " << purgeThreshold << ")";
+        LogLine() << "  dirty pages: " << dirtyPages.count() << " of " << DirtyPageMap::pagesFor(storage.size())
+                  << " since the last snapshot";
+        if constexpr (IndexPolicy::enabled) {
+            nameReady.report();
+            kindReady.report();
+            prefixReady.report();
+        }
+        [[maybe_unused]] auto cacheLock = sync.cache();
+        queryCache.reportMetrics();
+    }
+
+    void sortAnimals() {
+        [[maybe_unused]] auto lock = sync.write();
+        awaitIndexes();
+        purge();
+        std::vector<std::size_t> slots(storage.size());
+        for (std::size_t i = 0; i < slots.size(); ++i) {
+            slots[i] = i;
+        }
+        const std::vector<std::size_t> order = sortOrderByTypeAndName(
+            slots, [this](std::size_t slot) { return storage.kind(slot); },
+            [this](std::size_t slot) { return storage.name(slot); });
+        storage.permute(order);
+        for (std::size_t i = 0; i < order.size(); ++i) {
+            if (order[i] != i) {
+                dirtyPages.mark(i);
+            }
+        }
+        touchAllKinds();
+        changes.reordered(order);
+        permuteColumn(lines, order);
+        rebuildIndexes();
+    }
+
+    // Awaitable forms that run on the coroutine scheduler's workers. Async operations on one container
+    // take turns through asyncTurns: readers share a turn when the SyncPolicy is thread-safe, and
+    // otherwise every operation runs alone, so without a thread-safe SyncPolicy the synchronous API
+    // must not be used while any of them is in flight.
+    Task<void> sortAsync() {
+        co_await CoroutineScheduler::instance().schedule();
+        [[maybe_unused]] const auto turn = co_await asyncTurns.lock(false);
+        sortAnimals();
+    }
+
+    Task<void> displayAllAsync() const {
+        co_await CoroutineScheduler::instance().schedule();
+        [[maybe_unused]] const auto turn = co_await asyncTurns.lock(syncIsThreadSafe);
+        displayAll();
+    }
+
+    // Visits every live animal as (kind, name) in display order and returns how many it visited. The
+    // worker is yielded between chunks of slots, so a long scan does not hold up other coroutines; the
+    // read lock is held per chunk only, so on a thread-safe container a synchronous writer may land
+    // between chunks.
+    template <typename Visit>
+    Task<std::size_t> scanAsync(Visit visit, std::size_t chunk = 4096) const {
+        CoroutineScheduler& scheduler = CoroutineScheduler::instance();
+        co_await scheduler.schedule();
+        [[maybe_unused]] const auto turn = co_await asyncTurns.lock(syncIsThreadSafe);
+        chunk = std::max<std::size_t>(chunk, 1);
+        std::size_t visited = 0;
+        for (std::size_t first = 0;; first += chunk) {
+            {
+                [[maybe_unused]] auto lock = sync.read();
+                if (first >= live.size()) {
+                    break;
+                }
+                live.forEachLiveIn(first, std::min(first + chunk, live.size()), [&](std::size_t slot) {
+                    visit(storage.kind(slot), storage.name(slot));
+                    ++visited;
+                });
+            }
+            co_await scheduler.schedule();
+        }
+        co_return visited;
+    }
+
+    ~BasicAnimalContainer() {
+        awaitIndexes();
+        --instanceCount;
+    }
+};
+
+// Drives compactFor() from its own thread; every slice holds the container's write lock for at most
+// one budget, and slices are spaced by the same budget so foreground work always gets a turn.
+template <typename Container>
+class BackgroundCompactor {
+private:
+    Container& container;
+    std::chrono::microseconds budget;
+    std::chrono::milliseconds idleInterval;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::thread worker;
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping) {
+            lock.unlock();
+            const bool more = container.compactFor(budget);
+            lock.lock();
+            if (more) {
+                wake.wait_for(lock, budget, [this] { return stopping; });
+            } else {
+                wake.wait_for(lock, idleInterval, [this] { return stopping; });
+            }
+        }
+    }
+
+public:
+    static_assert(Container::syncIsThreadSafe, "background compaction needs a thread-safe SyncPolicy");
+
+    BackgroundCompactor(Container& container, std::chrono::microseconds budget,
+                        std::chrono::milliseconds idleInterval = std::chrono::milliseconds(100))
+        : container(container), budget(budget), idleInterval(idleInterval), worker([this] { run(); }) {}
+
+    BackgroundCompactor(const BackgroundCompactor&) = delete;
+    BackgroundCompactor& operator=(const BackgroundCompactor&) = delete;
+
+    ~BackgroundCompactor() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        worker.join();
+    }
+};
+
+using AnimalContainer = BasicAnimalContainer<PointerStorage, NoNameIndex, NullSync>;
+using ColumnarAnimalContainer = BasicAnimalContainer<ColumnStorage, HashNameIndex, NullSync>;
+using ConcurrentAnimalContainer = BasicAnimalContainer<ColumnStorage, HashNameIndex, ShardedSync<8>>;
+
+// Dense by-value store for a single kind; batch kernels walk it without virtual calls.
+template <typename T>
+class TypedAnimalContainer {
+private:
+    std::vector<T> animals;
+public:
+    void addAnimal(T animal) {
+        animals.push_back(std::move(animal));
+    }
+
+    void clear() {
+        animals.clear();
+    }
+
+    std::size_t removeByName(std::string_view name) {
+        return std::erase_if(animals, [name](const T& animal) { return animal.getName() == name; });
+    }
+
+    // Returns the applied order: position i now holds the animal previously at order[i].
+    std::vector<std::size_t> sortByName() {
+        std::vector<std::size_t> slots(animals.size());
+        for (std::size_t i = 0; i < slots.size(); ++i) {
+            slots[i] = i;
+        }
+        std::vector<std::size_t> order = sortOrderByTypeAndName(
+            slots, [](std::size_t) { return T::staticKind; },
+            [this](std::size_t slot) { return std::string_view(animals[slot].getName()); });
+        permuteColumn(animals, order);
+        return order;
+    }
+
+    [[nodiscard]] std::size_t size() const {
+        return animals.size();
+    }
+
+    [[nodiscard]] std::span<const T> view() const {
+        return animals;
+    }
+
+    [[nodiscard]] const T* find(std::string_view name) const {
+        for (const T& animal : animals) {
+            if (animal.getName() == name) {
+                return &animal;
+            }
+        }
+        return nullptr;
+    }
+
+    void renderDisplay(std::string& out) const {
+        T::displayBatch(view(), out);
+    }
+
+    void renderInfo(std::string& out) const {
+        T::infoBatch(view(), out);
+    }
+};
+
+// AnimalContainer-compatible facade over one TypedAnimalContainer per kind. Animals are kept
+// grouped by kind in type-name order (cats, then dogs), which is the order AnimalContainer's
+// sortAnimals() produces. Unlike AnimalContainer, an unsorted roster is therefore listed grouped by
+// kind rather than in insertion order; insertion order holds only within each kind. sortAnimals()
+// sorts each kind by name, after which both containers list the same order.
+class SegregatedAnimalContainer : public AnimalContainerBase {
+private:
+    TypedAnimalContainer<Cat> cats;
+    TypedAnimalContainer<Dog> dogs;
+    AnimalChangeLog changes;
+
+    static std::vector<std::uint32_t> positionRange(std::size_t first, std::size_t count) {
+        std::vector<std::uint32_t> positions(count);
+        for (std::size_t i = 0; i < count; ++i) {
+            positions[i] = static_cast<std::uint32_t>(first + i);
+        }
+        return positions;
+    }
+
+    template <typename Fn>
+    void forEachStore(Fn fn) const {
+        fn(cats);
+        fn(dogs);
+    }
+
+    static void write(std::string out) {
+        if (!out.empty()) {
+            LogSink::instance().write(std::move(out));
+        }
+    }
+
+public:
+    SegregatedAnimalContainer() {
+        ++instanceCount;
+    }
+
+    SegregatedAnimalContainer(const SegregatedAnimalContainer&) = delete;
+    SegregatedAnimalContainer& operator=(const SegregatedAnimalContainer&) = delete;
+
+    template <typename T>
+    [[nodiscard]] TypedAnimalContainer<T>& store() {
+        if constexpr (std::is_same_v<T, Dog>) {
+            return dogs;
+        } else {
+            return cats;
+        }
+    }
+
+    void addAnimal(const std::shared_ptr<Animal>& animal) {
+        switch (animal->getKind()) {
+        case AnimalKind::Dog:
+            changes.added(cats.size() + dogs.size(), animal);
+            dogs.addAnimal(static_cast<const Dog&>(*animal));
+            break;
+        case AnimalKind::Cat:
+            changes.added(cats.size(), animal);
+            cats.addAnimal(static_cast<const Cat&>(*animal));
+            break;
+        }
+    }
+
+    void displayAll() const {
+        std::string out;
+        forEachStore([&out](const auto& store) { store.renderDisplay(out); });
+        write(std::move(out));
+    }
+
+    void removeAnimal(const std::string& name) {
+        const auto kind = kindFromType(name);
+        if (kind == AnimalKind::Dog) {
+            changes.removed(positionRange(cats.size(), dogs.size()));
+            dogs.clear();
+        } else if (kind == AnimalKind::Cat) {
+            changes.removed(positionRange(0, cats.size()));
+            cats.clear();
+        }
+    }
+
+    void displayAnimalInfo(const std::string& name) const {
+        const auto kind = kindFromType(name);
+        std::string out;
+        if (kind == AnimalKind::Dog) {
+            dogs.renderInfo(out);
+        } else if (kind == AnimalKind::Cat) {
+            cats.renderInfo(out);
+        }
+        write(std::move(out));
+    }
+
+    std::size_t removeAnimalByName(std::string_view name) {
+        if (changes.enabled()) {
+            std::vector<std::uint32_t> positions;
+            std::uint32_t position = 0;
+            forEachStore([&](const auto& store) {
+                for (const auto& animal : store.view()) {
+                    if (animal.getName() == name) {
+                        positions.push_back(position);
+                    }
+                    ++position;
+                }
+            });
+            changes.removed(std::move(positions));
+        }
+        return cats.removeByName(name) + dogs.removeByName(name);
+    }
+
+    [[nodiscard]] AnimalQuery<SegregatedAnimalContainer> query() const {
+        return AnimalQuery<SegregatedAnimalContainer>(*this);
+    }
+
+    // A kind predicate narrows the scan to that kind's store. Slots carry the kind in the top bits.
+    template <typename Emit>
+    void executeQuery(const QuerySpec& spec, Emit emit) const {
+        constexpr unsigned kindShift = 56;
+        const auto kindAt = [](std::size_t slot) { return static_cast<AnimalKind>(slot >> kindShift); };
+        const auto nameAt = [this](std::size_t slot) -> std::string_view {
+            const std::size_t position = slot & ((std::size_t{1} << kindShift) - 1);
+            if (static_cast<AnimalKind>(slot >> kindShift) == AnimalKind::Dog) {
+                return dogs.view()[position].getName();
+            }
+            return cats.view()[position].getName();
+        };
+        finishQuery(spec, [&](auto visit) {
+            bool more = true;
+            forEachStore([&](const auto& store) {
+                using Stored = typename std::remove_cvref_t<decltype(store.view())>::value_type;
+                if (spec.kind && *spec.kind != Stored::staticKind) {
+                    return;
+                }
+                const std::size_t tag = static_cast<std::size_t>(Stored::staticKind) << kindShift;
+                for (std::size_t i = 0; more && i < store.size(); ++i) {
+                    more = visit(tag | i);
+                }
+            });
+        }, kindAt, nameAt, emit);
+    }
+
+    [[nodiscard]] std::string renderQuery(const QuerySpec& spec) const {
+        std::string out;
+        executeQuery(spec, [&out](AnimalKind kind, std::string_view name) { appendDisplayRow(out, kind, name); });
+        return out;
+    }
+
+    [[nodiscard]] std::vector<std::shared_ptr<Animal>> lookupMany(std::span<const std::string_view> names) const {
+        std::vector<std::shared_ptr<Animal>> found;
+        found.reserve(names.size());
+        for (std::string_view name : names) {
+            found.push_back(findAnimal(name));
+        }
+        return found;
+    }
+
+    [[nodiscard]] std::shared_ptr<Animal> findAnimal(std::string_view name) const {
+        if (const Cat* cat = cats.find(name)) {
+            return makeAnimal<Cat>(*cat);
+        }
+        if (const Dog* dog = dogs.find(name)) {
+            return makeAnimal<Dog>(*dog);
+        }
+        return nullptr;
+    }
+
+    void sortAnimals() {
+        const std::size_t catCount = cats.size();
+        std::vector<std::size_t> order = cats.sortByName();
+        for (std::size_t from : dogs.sortByName()) {
+            order.push_back(catCount + from);
+        }
+        changes.reordered(order);
+    }
+
+    void trackChanges(bool on) {
+        changes.track(on);
+    }
+
+    [[nodiscard]] std::vector<AnimalChange> takeChanges() {
+        return changes.take();
+    }
+
+    // Sorting and kind removals shift whole kinds, so without slot-stable storage every snapshot
+    // writes every page.
+    template <typename Child>
+    int forkSnapshot(bool, Child child) {
+#if defined(__linux__)
+        const std::size_t count = cats.size() + dogs.size();
+        const std::size_t pageCount = DirtyPageMap::pagesFor(count);
+        const std::vector<bool> dirty(pageCount, true);
+        const pid_t pid = fork();
+        if (pid == 0) {
+            child(pageCount, dirty, [this, count](std::size_t page, auto emit) {
+                const std::size_t first = page * DirtyPageMap::SlotsPerPage;
+                const std::size_t last = std::min(first + DirtyPageMap::SlotsPerPage, count);
+                for (std::size_t position = first; position < last; ++position) {
+                    if (position < cats.size()) {
+                        emit(Cat::staticKind, std::string_view(cats.view()[position].getName()));
+                    } else {
+                        emit(Dog::staticKind, std::string_view(dogs.view()[position - cats.size()].getName()));
+                    }
+                }
+            });
+        }
+        return pid;
+#else
+        (void)child;
+        return -1;
+#endif
+    }
+
+    bool compactFor(std::chrono::microseconds) {
+        return false;
+    }
+
+    void reportMetrics() const {
+        LogLine() << "Segregated storage: " << dogs.size() << " dogs, " << cats.size() << " cats";
+    }
+
+    ~SegregatedAnimalContainer() {
+        --instanceCount;
+    }
+};
+
+class AnimalObserver {
+public:
+    virtual ~AnimalObserver() = default;
+
+    virtual void update(const std::shared_ptr<Animal>&) {
+    }
+
+    // Receives one command's changes; the default forwards additions to update().
+    virtual void changed(std::span<const AnimalChange> batch) {
+        for (const AnimalChange& change : batch) {
+            if (const auto* added = std::get_if<AnimalAdded>(&change)) {
+                update(added->animal);
+            }
+        }
+    }
+
+    virtual void reportMetrics() const {
+    }
+};
+
+// What publish() does when an observer's queue is full: drop its oldest batch, or detach the observer
+// for good, for consumers that must see every event or none.
+enum class ObserverOverflow {
+    DropOldest,
+    Detach
+};
+
+struct ObserverOptions {
+    std::string name = "observer";
+    std::size_t capacity = 256;
+    ObserverOverflow overflow = ObserverOverflow::DropOldest;
+};
+
+// Every observer gets its own bounded batch queue and delivery thread, so publish() never waits on
+// an observer and a slow one only delays itself.
+class AnimalNotifier {
+private:
+    using Clock = std::chrono::steady_clock;
+    using Batch = std::shared_ptr<const std::vector<AnimalChange>>;
+
+    struct Queued {
+        Batch batch;
+        Clock::time_point published;
+    };
+
+    struct Subscription {
+        std::shared_ptr<AnimalObserver> observer;
+        ObserverOptions options;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable idle;
+        std::deque<Queued> queue;
+        bool busy = false;
+        bool stopping = false;
+        bool detached = false;
+        std::uint64_t delivered = 0;
+        std::uint64_t dropped = 0;
+        std::size_t maxDepth = 0;
+        Clock::duration totalLag{};
+        Clock::duration maxLag{};
+        // Held while the observer runs, so its own metrics can be read from another thread.
+        std::mutex observing;
+        std::thread worker;
+    };
+
+    std::list<std::unique_ptr<Subscription>> subscriptions;
+    std::uint64_t batches = 0;
+    std::array<std::uint64_t, std::variant_size_v<AnimalChange>> events{};
+
+    static void deliver(Subscription& sub) {
+        std::unique_lock lock(sub.mutex);
+        while (true) {
+            sub.wake.wait(lock, [&sub] { return sub.stopping || !sub.queue.empty(); });
+            if (sub.queue.empty()) {
+                return;
+            }
+            Queued next = std::move(sub.queue.front());
+            sub.queue.pop_front();
+            sub.busy = true;
+            lock.unlock();
+            {
+                std::lock_guard observing(sub.observing);
+                sub.observer->changed(*next.batch);
+            }
+            const Clock::duration lag = Clock::now() - next.published;
+            lock.lock();
+            sub.busy = false;
+            ++sub.delivered;
+            sub.totalLag += lag;
+            sub.maxLag = std::max(sub.maxLag, lag);
+            if (sub.queue.empty()) {
+                sub.idle.notify_all();
+            }
+        }
+    }
+
+    static void enqueue(Subscription& sub, const Batch& batch, Clock::time_point now) {
+        {
+            std::lock_guard lock(sub.mutex);
+            if (sub.detached) {
+                return;
+            }
+            if (sub.queue.size() >= sub.options.capacity) {
+                if (sub.options.overflow == ObserverOverflow::Detach) {
+                    sub.dropped += sub.queue.size() + 1;
+                    sub.queue.clear();
+                    sub.detached = true;
+                    sub.idle.notify_all();
+                    return;
+                }
+                sub.queue.pop_front();
+                ++sub.dropped;
+            }
+            sub.queue.push_back({batch, now});
+            sub.maxDepth = std::max(sub.maxDepth, sub.queue.size());
+        }
+        sub.wake.notify_one();
+    }
+
+public:
+    AnimalNotifier() = default;
+    AnimalNotifier(const AnimalNotifier&) = delete;
+    AnimalNotifier& operator=(const AnimalNotifier&) = delete;
+
+    void addObserver(const std::shared_ptr<AnimalObserver>& observer, ObserverOptions options = {}) {
+        auto sub = std::make_unique<Subscription>();
+        sub->observer = observer;
+        sub->options = std::move(options);
+        sub->options.capacity = std::max<std::size_t>(sub->options.capacity, 1);
+        sub->worker = std::thread(deliver, std::ref(*sub));
+        subscriptions.push_back(std::move(sub));
+    }
+
+    void publish(std::vector<AnimalChange> changes) {
+        if (changes.empty()) {
+            return;
+        }
+        ++batches;
+        for (const AnimalChange& change : changes) {
+            ++events[change.index()];
+        }
+        const Batch batch = std::make_shared<const std::vector<AnimalChange>>(std::move(changes));
+        const Clock::time_point now = Clock::now();
+        for (const auto& sub : subscriptions) {
+            enqueue(*sub, batch, now);
+        }
+    }
+
+    // Waits until every attached observer has drained its queue, or until the timeout.
+    bool waitIdle(std::chrono::milliseconds timeout) {
+        const Clock::time_point deadline = Clock::now() + timeout;
+        bool drained = true;
+        for (const auto& sub : subscriptions) {
+            std::unique_lock lock(sub->mutex);
+            drained = sub->idle.wait_until(lock, deadline, [&sub] {
+                return sub->detached || (sub->queue.empty() && !sub->busy);
+            }) && drained;
+        }
+        return drained;
+    }
+
+    void reportMetrics() {
+        LogLine() << "Change events: " << batches << " batches, " << events[0] << " added, " << events[1]
+                  << " removed, " << events[2] << " reordered";
+        const auto micros = [](Clock::duration d) {
+            return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+        };
+        for (const auto& sub : subscriptions) {
+            {
+                std::lock_guard lock(sub->mutex);
+                const auto averageLag = sub->delivered == 0 ? Clock::duration{} : sub->totalLag / static_cast<Clock::rep>(sub->delivered);
+                LogLine() << "  " << sub->options.name << ": depth " << sub->queue.size() << " (max "
+                          << sub->maxDepth << " of " << sub->options.capacity << "), " << sub->delivered
+                          << " delivered, " << sub->dropped << " dropped, lag avg " << micros(averageLag)
+                          << " us max " << micros(sub->maxLag) << " us" << (sub->detached ? ", detached" : "");
+            }
+            std::lock_guard observing(sub->observing);
+            sub->observer->reportMetrics();
+        }
+    }
+
+    ~AnimalNotifier() {
+        for (const auto& sub : subscriptions) {
+            {
+                std::lock_guard lock(sub->mutex);
+                sub->stopping = true;
+            }
+            sub->wake.notify_one();
+        }
+        for (const auto& sub : subscriptions) {
+            sub->worker.join();
+        }
+    }
+};
+
+class AnimalDetailsObserver : public AnimalObserver {
+public:
+    void update(const std::shared_ptr<Animal>& animal) override {
+        DiagnosticLine() << "Observer: " << animal->getType() << " Info: " << animal->getName();
+    }
+};
+
+// Mirrors the container's display order from change events alone, without ever rescanning it.
+class AnimalRosterObserver : public AnimalObserver {
+protected:
+    struct Entry {
+        AnimalKind kind;
+        std::string name;
+    };
+    std::vector<Entry> roster;
+public:
+    // Whether `batch` applies to a roster of `size` entries: additions land inside it, removed
+    // positions are ascending and present, and every reorder is a permutation of the whole roster.
+    // Batches from another process are checked with this before they are applied.
+    [[nodiscard]] static bool fits(std::span<const AnimalChange> batch, std::size_t size) {
+        std::vector<bool> moved;
+        for (const AnimalChange& change : batch) {
+            if (const auto* added = std::get_if<AnimalAdded>(&change)) {
+                if (added->position > size || added->animal == nullptr) {
+                    return false;
+                }
+                ++size;
+            } else if (const auto* removed = std::get_if<AnimalsRemoved>(&change)) {
+                const auto& positions = removed->positions;
+                for (std::size_t i = 0; i < positions.size(); ++i) {
+                    if (positions[i] >= size || (i != 0 && positions[i] <= positions[i - 1])) {
+                        return false;
+                    }
+                }
+                size -= positions.size();
+            } else if (const auto* reordered = std::get_if<AnimalsReordered>(&change)) {
+                moved.assign(size, false);
+                std::size_t covered = 0;
+                for (const auto& run : reordered->runs) {
+                    if (run.from > size || run.length > size - run.from) {
+                        return false;
+                    }
+                    for (std::size_t i = run.from; i < run.from + run.length; ++i) {
+                        if (moved[i]) {
+                            return false;
+                        }
+                        moved[i] = true;
+                    }
+                    covered += run.length;
+                }
+                if (covered != size) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    void changed(std::span<const AnimalChange> batch) override {
+        for (const AnimalChange& change : batch) {
+            if (const auto* added = std::get_if<AnimalAdded>(&change)) {
+                roster.insert(roster.begin() + added->position,
+                              Entry{added->animal->getKind(), added->animal->getName()});
+            } else if (const auto* removed = std::get_if<AnimalsRemoved>(&change)) {
+                std::size_t next = 0;
+                std::size_t kept = 0;
+                for (std::size_t i = 0; i < roster.size(); ++i) {
+                    if (next < removed->positions.size() && removed->positions[next] == i) {
+                        ++next;
+                    } else {
+                        if (kept != i) {
+                            roster[kept] = std::move(roster[i]);
+                        }
+                        ++kept;
+                    }
+                }
+                roster.resize(kept);
+            } else if (const auto* reordered = std::get_if<AnimalsReordered>(&change)) {
+                std::vector<Entry> permuted;
+                permuted.reserve(roster.size());
+                for (const auto& run : reordered->runs) {
+                    std::move(roster.begin() + run.from, roster.begin() + run.from + run.length,
+                              std::back_inserter(permuted));
+                }
+                roster = std::move(permuted);
+            }
+        }
+    }
+
+    void reportMetrics() const override {
+        std::array<std::size_t, AnimalKindCount> perKind{};
+        for (const Entry& entry : roster) {
+            ++perKind[static_cast<std::size_t>(entry.kind)];
+        }
+        LogLine() << "Roster observer: " << roster.size() << " animals (" << perKind[0] << " dogs, " << perKind[1]
+                  << " cats)";
+    }
+};
+
+// Fixed binary layout of one event on the shared-memory bus, mirrored by external consumers.
+// Removed and Reordered travel as runs: [first, first + count) are pre-removal positions, or old
+// positions in their new order. A batch is the events of one command; its last record is flagged.
+enum class AnimalEventType : std::uint8_t {
+    Added = 1,
+    Removed = 2,
+    Reordered = 3
+};
+
+struct AnimalEventRecord {
+    static constexpr std::uint8_t LastInBatch = 1;
+    static constexpr std::uint8_t NameTruncated = 2;
+
+    std::uint32_t batch;
+    AnimalEventType type;
+    std::uint8_t kind;
+    std::uint8_t flags;
+    std::uint8_t nameLength;
+    std::uint32_t first;
+    std::uint32_t count;
+    std::array<char, 40> name;
+
+    [[nodiscard]] std::string_view nameView() const {
+        return {name.data(), nameLength};
+    }
+};
+
+static_assert(sizeof(AnimalEventRecord) == 56 && std::is_trivially_copyable_v<AnimalEventRecord>);
+
+// Shared-memory segment: a header with the producer's head and one cursor per consumer, followed by a
+// power-of-two ring of cache-line slots. Each slot is a seqlock: the sequence is odd while the
+// producer writes it and 2 * (event number + 1) once the event is readable.
+struct SharedEventBusLayout {
+    static constexpr std::uint64_t Magic = 0x5355424c4d494e41;  // "ANIMLBUS"
+    static constexpr std::uint32_t Version = 3;
+    static constexpr std::size_t MaxConsumers = 16;
+    static constexpr std::size_t RecordWords = sizeof(AnimalEventRecord) / sizeof(std::uint64_t);
+
+    struct alignas(64) Slot {
+        std::atomic<std::uint64_t> sequence{0};
+        std::array<std::uint64_t, RecordWords> words{};
+    };
+
+    // A slot belongs to the reader whose pid it holds; readers take it over by CAS on pid, from 0 or
+    // from a pid that has exited. `active` only tells the producer's metrics which slots are in use.
+    struct alignas(64) Consumer {
+        std::atomic<std::uint32_t> active{0};
+        std::atomic<std::int32_t> pid{0};
+        std::atomic<std::uint64_t> cursor{0};
+        std::atomic<std::uint64_t> lost{0};
+    };
+
+    struct Header {
+        std::atomic<std::uint64_t> magic{0};
+        std::uint32_t version = Version;
+        std::uint32_t capacity = 0;
+        std::atomic<std::int32_t> owner{0};
+        std::atomic<std::uint32_t> closed{0};
+        alignas(64) std::atomic<std::uint64_t> head{0};
+        std::array<Consumer, MaxConsumers> consumers;
+    };
+
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "bus atomics must be address-free");
+    static_assert(sizeof(Slot) == 64);
+
+    static std::size_t bytes(std::uint32_t capacity) {
+        return sizeof(Header) + std::size_t{capacity} * sizeof(Slot);
+    }
+
+    static Slot* slots(Header* header) {
+        return reinterpret_cast<Slot*>(reinterpret_cast<char*>(header) + sizeof(Header));
+    }
+};
+
+#if defined(__linux__)
+// Whether the shared-memory object `name` was left behind by a producer that has exited: it was fully
+// published, with Layout's magic, and the owner pid recorded in its header no longer exists. A segment
+// that is still being set up, or belongs to something else, is never treated as abandoned.
+template <typename Layout>
+bool sharedSegmentAbandoned(const std::string& name) {
+    const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        return errno == ENOENT;
+    }
+    struct stat status{};
+    bool abandoned = false;
+    if (fstat(fd, &status) == 0 && static_cast<std::size_t>(status.st_size) >= sizeof(typename Layout::Header)) {
+        void* base = mmap(nullptr, sizeof(typename Layout::Header), PROT_READ, MAP_SHARED, fd, 0);
+        if (base != MAP_FAILED) {
+            const auto* header = static_cast<const typename Layout::Header*>(base);
+            const pid_t owner = header->owner.load(std::memory_order_relaxed);
+            abandoned = header->magic.load(std::memory_order_acquire) == Layout::Magic && owner != 0 &&
+                        kill(owner, 0) != 0 && errno == ESRCH;
+            munmap(base, sizeof(typename Layout::Header));
+        }
+    }
+    close(fd);
+    return abandoned;
+}
+
+// Creates `name` exclusively, taking it over only from an owner that has exited. Fails with EEXIST
+// while another producer holds it.
+template <typename Layout>
+int createSharedSegment(const std::string& name, mode_t mode) {
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, mode);
+    if (fd < 0 && errno == EEXIST && sharedSegmentAbandoned<Layout>(name)) {
+        shm_unlink(name.c_str());
+        fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, mode);
+    }
+    return fd;
+}
+#endif
+
+// Producer side of the bus. It never waits for consumers: a consumer that falls a full ring behind
+// notices the overwritten sequence numbers, skips ahead and counts what it lost.
+class SharedEventBus {
+private:
+    using Layout = SharedEventBusLayout;
+
+    std::string name;
+    Layout::Header* header = nullptr;
+    Layout::Slot* slots = nullptr;
+    std::size_t mappedBytes = 0;
+    std::uint64_t head = 0;
+    std::uint32_t batches = 0;
+    std::vector<AnimalEventRecord> pending;
+
+    void write(const AnimalEventRecord& record) {
+        Layout::Slot& slot = slots[head & (header->capacity - 1)];
+        std::array<std::uint64_t, Layout::RecordWords> words;
+        std::memcpy(words.data(), &record, sizeof(record));
+        slot.sequence.store(2 * head + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (std::size_t i = 0; i < words.size(); ++i) {
+            std::atomic_ref(slot.words[i]).store(words[i], std::memory_order_relaxed);
+        }
+        slot.sequence.store(2 * head + 2, std::memory_order_release);
+        ++head;
+    }
+
+    void pushRun(AnimalEventType type, std::uint32_t first, std::uint32_t count) {
+        AnimalEventRecord record{};
+        record.batch = batches;
+        record.type = type;
+        record.first = first;
+        record.count = count;
+        pending.push_back(record);
+    }
+
+public:
+    explicit SharedEventBus(std::string busName, std::uint32_t capacity = 1u << 16) : name(std::move(busName)) {
+#if defined(__linux__)
+        capacity = std::bit_ceil(std::max<std::uint32_t>(capacity, 64));
+        mappedBytes = Layout::bytes(capacity);
+        const int fd = createSharedSegment<Layout>(name, 0600);
+        if (fd < 0) {
+            const std::string reason = errno == EEXIST ? "in use by another producer" : std::strerror(errno);
+            throw std::runtime_error("Cannot create event bus " + name + ": " + reason);
+        }
+        void* base = ftruncate(fd, static_cast<off_t>(mappedBytes)) == 0
+                         ? mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+                         : MAP_FAILED;
+        close(fd);
+        if (base == MAP_FAILED) {
+            shm_unlink(name.c_str());
+            throw std::runtime_error("Cannot map event bus " + name + ": " + std::strerror(errno));
+        }
+        header = new (base) Layout::Header();
+        header->capacity = capacity;
+        header->owner.store(getpid(), std::memory_order_relaxed);
+        slots = Layout::slots(header);
+        std::uninitialized_default_construct_n(slots, capacity);
+        header->magic.store(Layout::Magic, std::memory_order_release);
+#else
+        (void)capacity;
+        throw std::runtime_error("Shared-memory event bus needs Linux");
+#endif
+    }
+
+    SharedEventBus(const SharedEventBus&) = delete;
+    SharedEventBus& operator=(const SharedEventBus&) = delete;
+
+    void publish(std::span<const AnimalChange> batch) {
+        pending.clear();
+        for (const AnimalChange& change : batch) {
+            if (const auto* added = std::get_if<AnimalAdded>(&change)) {
+                AnimalEventRecord record{};
+                record.batch = batches;
+                record.type = AnimalEventType::Added;
+                record.kind = static_cast<std::uint8_t>(added->animal->getKind());
+                record.first = added->position;
+                record.count = 1;
+                const std::string& animalName = added->animal->getName();
+                record.nameLength = static_cast<std::uint8_t>(std::min(animalName.size(), record.name.size()));
+                if (record.nameLength < animalName.size()) {
+                    record.flags |= AnimalEventRecord::NameTruncated;
+                }
+                std::memcpy(record.name.data(), animalName.data(), record.nameLength);
+                pending.push_back(record);
+            } else if (const auto* removed = std::get_if<AnimalsRemoved>(&change)) {
+                const auto& positions = removed->positions;
+                for (std::size_t begin = 0, end = 0; begin < positions.size(); begin = end) {
+                    for (end = begin + 1; end < positions.size() && positions[end] == positions[end - 1] + 1; ++end) {
+                    }
+                    pushRun(AnimalEventType::Removed, positions[begin], static_cast<std::uint32_t>(end - begin));
+                }
+            } else if (const auto* reordered = std::get_if<AnimalsReordered>(&change)) {
+                for (const auto& run : reordered->runs) {
+                    pushRun(AnimalEventType::Reordered, run.from, run.length);
+                }
+            }
+        }
+        if (pending.empty()) {
+            return;
+        }
+        pending.back().flags |= AnimalEventRecord::LastInBatch;
+        for (const AnimalEventRecord& record : pending) {
+            write(record);
+        }
+        header->head.store(head, std::memory_order_release);
+        ++batches;
+    }
+
+    void reportMetrics() const {
+        std::size_t active = 0;
+        for (const auto& consumer : header->consumers) {
+            active += consumer.active.load(std::memory_order_relaxed);
+        }
+        LogLine() << "Event bus " << name << ": " << head << " events, " << batches << " batches, capacity "
+                  << header->capacity << ", " << active << " consumers";
+        for (const auto& consumer : header->consumers) {
+            if (consumer.active.load(std::memory_order_acquire)) {
+                LogLine() << "  consumer pid " << consumer.pid.load(std::memory_order_relaxed) << ": lag "
+                          << head - std::min(head, consumer.cursor.load(std::memory_order_relaxed)) << ", lost "
+                          << consumer.lost.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    ~SharedEventBus() {
+#if defined(__linux__)
+        header->closed.store(1, std::memory_order_release);
+        munmap(header, mappedBytes);
+        shm_unlink(name.c_str());
+#endif
+    }
+};
+
+// Consumer side: attaches to an existing bus, claims a cursor slot and reads records straight out of
+// the shared ring. The only copy is the 56-byte record, which the seqlock check needs.
+class SharedEventBusReader {
+private:
+    using Layout = SharedEventBusLayout;
+
+    Layout::Header* header = nullptr;
+    Layout::Slot* slots = nullptr;
+    Layout::Consumer* consumer = nullptr;
+    std::size_t mappedBytes = 0;
+    std::uint64_t cursor = 0;
+
+    // Skips past events the producer has already overwritten.
+    void skipOverwritten() {
+        const std::uint64_t head = header->head.load(std::memory_order_acquire);
+        const std::uint64_t oldest = head > header->capacity ? head - header->capacity : 0;
+        const std::uint64_t resume = std::max(cursor + 1, oldest);
+        consumer->lost.fetch_add(resume - cursor, std::memory_order_relaxed);
+        cursor = resume;
+    }
+
+#if defined(__linux__)
+    static bool exited(pid_t pid) {
+        return pid != 0 && kill(pid, 0) != 0 && errno == ESRCH;
+    }
+
+    // Free slots hold pid 0; slots of consumers that exited without detaching are reclaimed. The CAS
+    // on pid lets only one of several racing readers take a slot.
+    static bool claim(Layout::Consumer& slot) {
+        std::int32_t owner = slot.pid.load(std::memory_order_acquire);
+        if ((owner != 0 && !exited(owner)) || !slot.pid.compare_exchange_strong(owner, getpid())) {
+            return false;
+        }
+        slot.active.store(1, std::memory_order_release);
+        return true;
+    }
+#endif
+
+public:
+    explicit SharedEventBusReader(const std::string& name) {
+#if defined(__linux__)
+        const int fd = shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open event bus " + name + ": " + std::strerror(errno));
+        }
+        struct stat info {};
+        void* base = fstat(fd, &info) == 0 && static_cast<std::size_t>(info.st_size) >= sizeof(Layout::Header)
+                         ? mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ | PROT_WRITE, MAP_SHARED,
+                                fd, 0)
+                         : MAP_FAILED;
+        close(fd);
+        if (base == MAP_FAILED) {
+            throw std::runtime_error("Cannot map event bus " + name);
+        }
+        mappedBytes = static_cast<std::size_t>(info.st_size);
+        header = static_cast<Layout::Header*>(base);
+        if (header->magic.load(std::memory_order_acquire) != Layout::Magic || header->version != Layout::Version ||
+            Layout::bytes(header->capacity) > mappedBytes) {
+            munmap(base, mappedBytes);
+            throw std::runtime_error("Incompatible event bus " + name);
+        }
+        slots = Layout::slots(header);
+        for (auto& slot : header->consumers) {
+            if (claim(slot)) {
+                consumer = &slot;
+                break;
+            }
+        }
+        if (consumer == nullptr) {
+            munmap(base, mappedBytes);
+            throw std::runtime_error("Event bus " + name + " has no free consumer slots");
+        }
+        cursor = header->head.load(std::memory_order_acquire);
+        consumer->lost.store(0);
+        consumer->cursor.store(cursor, std::memory_order_release);
+#else
+        (void)name;
+        throw std::runtime_error("Shared-memory event bus needs Linux");
+#endif
+    }
+
+    SharedEventBusReader(const SharedEventBusReader&) = delete;
+    SharedEventBusReader& operator=(const SharedEventBusReader&) = delete;
+
+    // Hands up to max ready records to fn; returns how many were delivered.
+    template <typename Fn>
+    std::size_t poll(Fn fn, std::size_t max = std::numeric_limits<std::size_t>::max()) {
+        std::size_t delivered = 0;
+        std::array<std::uint64_t, Layout::RecordWords> words;
+        while (delivered < max) {
+            const Layout::Slot& slot = slots[cursor & (header->capacity - 1)];
+            const std::uint64_t expected = 2 * cursor + 2;
+            const std::uint64_t before = slot.sequence.load(std::memory_order_acquire);
+            if (before < expected) {
+                break;
+            }
+            if (before == expected) {
+                for (std::size_t i = 0; i < words.size(); ++i) {
+                    words[i] = std::atomic_ref(const_cast<std::uint64_t&>(slot.words[i])).load(std::memory_order_relaxed);
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+            }
+            if (before != expected || slot.sequence.load(std::memory_order_relaxed) != expected) {
+                skipOverwritten();
+                continue;
+            }
+            AnimalEventRecord record;
+            std::memcpy(&record, words.data(), sizeof(record));
+            fn(record);
+            ++cursor;
+            ++delivered;
+        }
+        consumer->cursor.store(cursor, std::memory_order_release);
+        return delivered;
+    }
+
+    // True once the producer has shut down, or died without closing the bus, and every remaining
+    // event has been read.
+    [[nodiscard]] bool finished() const {
+        bool stopped = header->closed.load(std::memory_order_acquire) != 0;
+#if defined(__linux__)
+        stopped = stopped || exited(header->owner.load(std::memory_order_acquire));
+#endif
+        return stopped && cursor >= header->head.load(std::memory_order_acquire);
+    }
+
+    [[nodiscard]] std::uint64_t lost() const {
+        return consumer->lost.load(std::memory_order_relaxed);
+    }
+
+    ~SharedEventBusReader() {
+#if defined(__linux__)
+        consumer->active.store(0, std::memory_order_release);
+        consumer->pid.store(0, std::memory_order_release);
+        munmap(header, mappedBytes);
+#endif
+    }
+};
+
+// Forwards notifier batches onto the bus; its delivery thread is the bus's single producer.
+class SharedEventBusObserver : public AnimalObserver {
+private:
+    SharedEventBus bus;
+public:
+    explicit SharedEventBusObserver(std::string name) : bus(std::move(name)) {
+    }
+
+    void changed(std::span<const AnimalChange> batch) override {
+        bus.publish(batch);
+    }
+
+    void reportMetrics() const override {
+        bus.reportMetrics();
+    }
+};
+
+// Shared-memory layout of a published container view: a header followed by two equally sized buffers.
+// The publisher fills the inactive buffer under that buffer's seqlock, then flips `active`, so readers
+// only retry when the publisher laps them twice during one scan. Each buffer holds the display order as
+// columns: kinds[count], name offsets[count + 1], then the name bytes.
+struct SharedViewLayout {
+    static constexpr std::uint64_t Magic = 0x574549564d494e41;  // "ANIMVIEW"
+    static constexpr std::uint32_t Version = 2;
+
+    struct alignas(64) Buffer {
+        std::atomic<std::uint64_t> sequence{0};
+        std::uint64_t epoch = 0;
+        std::uint32_t count = 0;
+        std::uint32_t nameBytes = 0;
+    };
+
+    struct Header {
+        std::atomic<std::uint64_t> magic{0};
+        std::uint32_t version = Version;
+        std::atomic<std::uint32_t> active{0};
+        std::uint64_t bufferBytes = 0;
+        std::atomic<std::uint32_t> closed{0};
+        std::atomic<std::int32_t> owner{0};
+        std::array<Buffer, 2> buffers;
+    };
+
+    static std::size_t offsetsAt(std::uint32_t count) {
+        return (std::size_t{count} + 3) & ~std::size_t{3};
+    }
+
+    static std::size_t namesAt(std::uint32_t count) {
+        return offsetsAt(count) + (std::size_t{count} + 1) * sizeof(std::uint32_t);
+    }
+
+    static char* buffer(Header* header, std::uint32_t index) {
+        return reinterpret_cast<char*>(header) + sizeof(Header) + index * header->bufferBytes;
+    }
+};
+
+// Mirrors the container from change events and republishes it as a shared-memory view after every
+// batch. Runs on its own notifier thread, so publishing never holds up the menu or the container.
+class SharedViewPublisher : public AnimalRosterObserver {
+private:
+    using Layout = SharedViewLayout;
+
+    std::string name;
+    Layout::Header* header = nullptr;
+    std::size_t mappedBytes = 0;
+    std::uint64_t epoch = 0;
+    std::uint64_t overflows = 0;
+
+    void publish() {
+        std::size_t nameBytes = 0;
+        for (const Entry& entry : roster) {
+            nameBytes += entry.name.size();
+        }
+        const auto count = static_cast<std::uint32_t>(roster.size());
+        if (Layout::namesAt(count) + nameBytes > header->bufferBytes) {
+            ++overflows;
+            return;
+        }
+        const std::uint32_t target = 1 - header->active.load(std::memory_order_relaxed);
+        Layout::Buffer& buffer = header->buffers[target];
+        const std::uint64_t sequence = buffer.sequence.load(std::memory_order_relaxed);
+        buffer.sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        char* data = Layout::buffer(header, target);
+        auto* offsets = reinterpret_cast<std::uint32_t*>(data + Layout::offsetsAt(count));
+        char* names = data + Layout::namesAt(count);
+        std::uint32_t offset = 0;
+        for (std::uint32_t i = 0; i < count; ++i) {
+            data[i] = static_cast<char>(roster[i].kind);
+            offsets[i] = offset;
+            std::memcpy(names + offset, roster[i].name.data(), roster[i].name.size());
+            offset += static_cast<std::uint32_t>(roster[i].name.size());
+        }
+        offsets[count] = offset;
+        buffer.count = count;
+        buffer.nameBytes = offset;
+        buffer.epoch = ++epoch;
+
+        buffer.sequence.store(sequence + 2, std::memory_order_release);
+        header->active.store(target, std::memory_order_release);
+    }
+
+public:
+    SharedViewPublisher(std::string viewName, std::size_t bufferBytes) : name(std::move(viewName)) {
+#if defined(__linux__)
+        mappedBytes = sizeof(Layout::Header) + 2 * bufferBytes;
+        const int fd = createSharedSegment<Layout>(name, 0644);
+        if (fd < 0) {
+            const std::string reason = errno == EEXIST ? "in use by another publisher" : std::strerror(errno);
+            throw std::runtime_error("Cannot create view " + name + ": " + reason);
+        }
+        // The segment is sparse; only the pages a snapshot touches are ever backed.
+        void* base = ftruncate(fd, static_cast<off_t>(mappedBytes)) == 0
+                         ? mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+                         : MAP_FAILED;
+        close(fd);
+        if (base == MAP_FAILED) {
+            shm_unlink(name.c_str());
+            throw std::runtime_error("Cannot map view " + name + ": " + std::strerror(errno));
+        }
+        header = new (base) Layout::Header();
+        header->bufferBytes = bufferBytes & ~std::size_t{63};
+        header->owner.store(getpid(), std::memory_order_relaxed);
+        publish();
+        header->magic.store(Layout::Magic, std::memory_order_release);
+#else
+        (void)bufferBytes;
+        throw std::runtime_error("Shared-memory view needs Linux");
+#endif
+    }
+
+    SharedViewPublisher(const SharedViewPublisher&) = delete;
+    SharedViewPublisher& operator=(const SharedViewPublisher&) = delete;
+
+    void changed(std::span<const AnimalChange> batch) override {
+        AnimalRosterObserver::changed(batch);
+        publish();
+    }
+
+    void reportMetrics() const override {
+        LogLine() << "Shared view " << name << ": epoch " << epoch << ", " << roster.size() << " animals, "
+                  << header->bufferBytes << " bytes per buffer, " << overflows << " oversized snapshots skipped";
+    }
+
+    ~SharedViewPublisher() override {
+#if defined(__linux__)
+        header->closed.store(1, std::memory_order_release);
+        munmap(header, mappedBytes);
+        shm_unlink(name.c_str());
+#endif
+    }
+};
+
+// Read-only client of a published view. read() runs fn directly on the mapped columns and reruns it
+// if the publisher overwrote the buffer meanwhile, so fn must only compute its result.
+class SharedViewReader {
+private:
+    using Layout = SharedViewLayout;
+
+    const Layout::Header* header = nullptr;
+    std::size_t mappedBytes = 0;
+
+public:
+    // One consistent buffer; accessors clamp so a torn read can never leave the mapping.
+    class Snapshot {
+    private:
+        const char* kinds;
+        const std::uint32_t* offsets;
+        const char* names;
+        std::uint32_t count;
+        std::uint32_t nameBytes;
+        std::uint64_t snapshotEpoch;
+        friend class SharedViewReader;
+
+        Snapshot(const char* data, const Layout::Buffer& buffer, std::size_t bufferBytes)
+            : kinds(data), offsets(nullptr), names(nullptr), count(buffer.count), nameBytes(buffer.nameBytes),
+              snapshotEpoch(buffer.epoch) {
+            if (Layout::namesAt(count) + nameBytes > bufferBytes) {
+                count = 0;
+                nameBytes = 0;
+            }
+            offsets = reinterpret_cast<const std::uint32_t*>(data + Layout::offsetsAt(count));
+            names = data + Layout::namesAt(count);
+        }
+
+    public:
+        [[nodiscard]] std::size_t size() const {
+            return count;
+        }
+
+        [[nodiscard]] std::uint64_t epoch() const {
+            return snapshotEpoch;
+        }
+
+        [[nodiscard]] AnimalKind kind(std::size_t i) const {
+            return static_cast<AnimalKind>(static_cast<std::uint8_t>(kinds[i]) % AnimalKindCount);
+        }
+
+        [[nodiscard]] std::string_view name(std::size_t i) const {
+            const std::uint32_t begin = std::min(offsets[i], nameBytes);
+            const std::uint32_t end = std::clamp(offsets[i + 1], begin, nameBytes);
+            return {names + begin, end - begin};
+        }
+    };
+
+    explicit SharedViewReader(const std::string& name) {
+#if defined(__linux__)
+        const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open view " + name + ": " + std::strerror(errno));
+        }
+        struct stat info {};
+        void* base = fstat(fd, &info) == 0 && static_cast<std::size_t>(info.st_size) >= sizeof(Layout::Header)
+                         ? mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0)
+                         : MAP_FAILED;
+        close(fd);
+        if (base == MAP_FAILED) {
+            throw std::runtime_error("Cannot map view " + name);
+        }
+        mappedBytes = static_cast<std::size_t>(info.st_size);
+        header = static_cast<const Layout::Header*>(base);
+        if (header->magic.load(std::memory_order_acquire) != Layout::Magic || header->version != Layout::Version ||
+            sizeof(Layout::Header) + 2 * header->bufferBytes > mappedBytes) {
+            munmap(base, mappedBytes);
+            throw std::runtime_error("Incompatible view " + name);
+        }
+#else
+        (void)name;
+        throw std::runtime_error("Shared-memory view needs Linux");
+#endif
+    }
+
+    SharedViewReader(const SharedViewReader&) = delete;
+    SharedViewReader& operator=(const SharedViewReader&) = delete;
+
+    template <typename Fn>
+    auto read(Fn fn) const {
+        auto* mutableHeader = const_cast<Layout::Header*>(header);
+        while (true) {
+            const std::uint32_t index = header->active.load(std::memory_order_acquire) & 1;
+            const Layout::Buffer& buffer = header->buffers[index];
+            const std::uint64_t sequence = buffer.sequence.load(std::memory_order_acquire);
+            if (sequence % 2 == 0) {
+                auto result = fn(Snapshot(Layout::buffer(mutableHeader, index), buffer, header->bufferBytes));
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (buffer.sequence.load(std::memory_order_relaxed) == sequence) {
+                    return result;
+                }
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    [[nodiscard]] bool closed() const {
+        return header->closed.load(std::memory_order_acquire) != 0;
+    }
+
+    ~SharedViewReader() {
+#if defined(__linux__)
+        munmap(const_cast<Layout::Header*>(header), mappedBytes);
+#endif
+    }
+};
+
+// Replication wire format over a Unix stream socket: every frame is this header followed by `length`
+// payload bytes. Timestamps are steady_clock nanoseconds, which on Linux is CLOCK_MONOTONIC and so
+// comparable between processes on one host.
+struct ReplicationFrame {
+    enum class Type : std::uint32_t {
+        Snapshot = 1,
+        Batch = 2,
+        Heartbeat = 3
+    };
+
+    // Frames longer than this are treated as a corrupt stream rather than allocated.
+    static constexpr std::uint32_t MaxLength = 1u << 28;
+
+    Type type;
+    std::uint32_t length;
+    std::uint64_t sequence;
+    std::int64_t sentNanos;
+};
+
+inline std::int64_t replicationNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// Builds one frame: a Frame header (filled in by finish) followed by the encoded payload.
+template <typename Frame>
+class WireEncoder {
+private:
+    std::string bytes = std::string(sizeof(Frame), '\0');
+public:
+    template <typename T>
+    void put(T value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        bytes.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    void putName(std::string_view name) {
+        put(static_cast<std::uint32_t>(name.size()));
+        bytes.append(name);
+    }
+
+    void putBytes(std::string_view raw) {
+        bytes.append(raw);
+    }
+
+    [[nodiscard]] std::string payload() && {
+        return std::move(bytes).substr(sizeof(Frame));
+    }
+
+    void putChanges(std::span<const AnimalChange> batch) {
+        put(static_cast<std::uint32_t>(batch.size()));
+        for (const AnimalChange& change : batch) {
+            put(static_cast<std::uint8_t>(change.index()));
+            if (const auto* added = std::get_if<AnimalAdded>(&change)) {
+                put(added->animal->getKind());
+                put(added->position);
+                putName(added->animal->getName());
+            } else if (const auto* removed = std::get_if<AnimalsRemoved>(&change)) {
+                put(static_cast<std::uint32_t>(removed->positions.size()));
+                for (std::uint32_t position : removed->positions) {
+                    put(position);
+                }
+            } else if (const auto* reordered = std::get_if<AnimalsReordered>(&change)) {
+                put(static_cast<std::uint32_t>(reordered->runs.size()));
+                for (const auto& run : reordered->runs) {
+                    put(run);
+                }
+            }
+        }
+    }
+
+    // Fills in the header's payload length and hands over the finished frame.
+    [[nodiscard]] std::string finish(Frame frame) && {
+        frame.length = static_cast<std::uint32_t>(bytes.size() - sizeof(Frame));
+        std::memcpy(bytes.data(), &frame, sizeof(frame));
+        return std::move(bytes);
+    }
+};
+
+using ReplicationEncoder = WireEncoder<ReplicationFrame>;
+
+class WireDecoder {
+private:
+    std::string_view bytes;
+
+    void need(std::size_t size) const {
+        if (bytes.size() < size) {
+            throw std::runtime_error("Malformed frame");
+        }
+    }
+
+public:
+    explicit WireDecoder(std::string_view payload) : bytes(payload) {}
+    explicit WireDecoder(std::string&&) = delete;
+
+    [[nodiscard]] bool done() const {
+        return bytes.empty();
+    }
+
+    template <typename T>
+    T get() {
+        need(sizeof(T));
+        T value;
+        std::memcpy(&value, bytes.data(), sizeof(T));
+        bytes.remove_prefix(sizeof(T));
+        return value;
+    }
+
+    std::string_view getName() {
+        const auto size = get<std::uint32_t>();
+        need(size);
+        const std::string_view name = bytes.substr(0, size);
+        bytes.remove_prefix(size);
+        return name;
+    }
+
+    // Reads an element count, refusing one that could not fit in what is left of the payload when
+    // every element takes at least `minBytes`; a bad frame then throws instead of allocating.
+    std::size_t getCount(std::size_t minBytes) {
+        const auto count = get<std::uint32_t>();
+        if (count > bytes.size() / minBytes) {
+            throw std::runtime_error("Malformed frame");
+        }
+        return count;
+    }
+
+    AnimalKind getKind() {
+        const auto kind = get<AnimalKind>();
+        if (static_cast<std::size_t>(kind) >= AnimalKindCount) {
+            throw std::runtime_error("Malformed frame");
+        }
+        return kind;
+    }
+
+    std::vector<AnimalChange> getChanges() {
+        // The smallest change is a Removed or Reordered with no entries: a tag and a count.
+        std::vector<AnimalChange> batch(getCount(sizeof(std::uint8_t) + sizeof(std::uint32_t)));
+        for (AnimalChange& change : batch) {
+            switch (get<std::uint8_t>()) {
+            case 0: {
+                const AnimalKind kind = getKind();
+                const auto position = get<std::uint32_t>();
+                change = AnimalAdded{position,
+                                     animalKinds[static_cast<std::size_t>(kind)].create(std::string(getName()))};
+                break;
+            }
+            case 1: {
+                AnimalsRemoved removed;
+                removed.positions.resize(getCount(sizeof(std::uint32_t)));
+                for (std::uint32_t& position : removed.positions) {
+                    position = get<std::uint32_t>();
+                }
+                change = std::move(removed);
+                break;
+            }
+            case 2: {
+                AnimalsReordered reordered;
+                reordered.runs.resize(getCount(sizeof(AnimalsReordered::Run)));
+                for (auto& run : reordered.runs) {
+                    run = get<AnimalsReordered::Run>();
+                }
+                change = std::move(reordered);
+                break;
+            }
+            default:
+                throw std::runtime_error("Malformed frame");
+            }
+        }
+        return batch;
+    }
+};
+
+#if defined(__linux__)
+inline sockaddr_un replicationAddress(const std::string& path) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error("Socket path too long: " + path);
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
+
+// Removes a socket left at `path` by a listener that has exited, so it can be bound again. A socket
+// that still accepts connections, or anything that is not a socket, is left alone and reported.
+inline void reclaimSocketPath(const std::string& path) {
+    struct stat status{};
+    if (lstat(path.c_str(), &status) != 0) {
+        return;
+    }
+    if (!S_ISSOCK(status.st_mode)) {
+        throw std::runtime_error("Cannot listen on " + path + ": not a socket");
+    }
+    const sockaddr_un address = replicationAddress(path);
+    const int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    const bool live = probe >= 0 && connect(probe, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0;
+    const bool refused = errno == ECONNREFUSED;
+    if (probe >= 0) {
+        close(probe);
+    }
+    if (live) {
+        throw std::runtime_error("Cannot listen on " + path + ": in use by another process");
+    }
+    if (refused) {
+        unlink(path.c_str());
+    }
+}
+
+inline bool sendFrame(int fd, std::string_view frame, int flags) {
+    while (!frame.empty()) {
+        const ssize_t sent = send(fd, frame.data(), frame.size(), flags | MSG_NOSIGNAL);
+        if (sent <= 0) {
+            return false;
+        }
+        frame.remove_prefix(static_cast<std::size_t>(sent));
+    }
+    return true;
+}
+
+inline bool receiveExactly(int fd, char* data, std::size_t size) {
+    while (size != 0) {
+        const ssize_t received = recv(fd, data, size, 0);
+        if (received <= 0) {
+            return false;
+        }
+        data += received;
+        size -= static_cast<std::size_t>(received);
+    }
+    return true;
+}
+#endif
+
+// Primary side of replication. Followers connecting to the socket get a snapshot of the mirrored
+// roster, then every batch as one frame, plus a heartbeat every 100 ms so they can bound staleness.
+// Batches are sent without blocking; a follower whose socket buffer is full is disconnected and
+// re-bootstraps from a fresh snapshot, so a slow follower never holds up the others.
+class ReplicationPrimary : public AnimalRosterObserver {
+private:
+    std::string path;
+    int listenFd = -1;
+    mutable std::mutex mutex;
+    std::vector<int> followers;
+    // Batches published while a new follower's snapshot is on the wire; they are sent to it once the
+    // snapshot is through, so it does not miss any.
+    bool joining = false;
+    std::vector<std::string> joiningBacklog;
+    std::uint64_t sequence = 0;
+    std::uint64_t framesSent = 0;
+    std::uint64_t bytesSent = 0;
+    std::uint64_t accepted = 0;
+    std::uint64_t disconnected = 0;
+    std::atomic<bool> stopping{false};
+    std::thread acceptor;
+
+    // Caller holds the mutex.
+    void broadcast(const std::string& frame) {
+#if defined(__linux__)
+        if (joining) {
+            joiningBacklog.push_back(frame);
+        }
+        std::erase_if(followers, [&](int fd) {
+            if (sendFrame(fd, frame, MSG_DONTWAIT)) {
+                ++framesSent;
+                bytesSent += frame.size();
+                return false;
+            }
+            close(fd);
+            ++disconnected;
+            return true;
+        });
+#else
+        (void)frame;
+#endif
+    }
+
+    void bootstrap(int fd) {
+#if defined(__linux__)
+        const timeval timeout{1, 0};
+        const int bufferBytes = 4 << 20;
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufferBytes, sizeof(bufferBytes));
+        // The roster is encoded under the mutex but sent outside it, so a slow follower holds up
+        // neither changed() nor the other followers for the length of the send timeout.
+        std::string frame;
+        {
+            std::lock_guard lock(mutex);
+            ReplicationEncoder snapshot;
+            snapshot.put(static_cast<std::uint32_t>(roster.size()));
+            for (const Entry& entry : roster) {
+                snapshot.put(entry.kind);
+                snapshot.putName(entry.name);
+            }
+            frame = std::move(snapshot).finish({ReplicationFrame::Type::Snapshot, 0, sequence, replicationNow()});
+            joining = true;
+        }
+        const bool sent = sendFrame(fd, frame, 0);
+        std::lock_guard lock(mutex);
+        joining = false;
+        const std::vector<std::string> backlog = std::exchange(joiningBacklog, {});
+        if (!sent) {
+            close(fd);
+            ++disconnected;
+            return;
+        }
+        ++accepted;
+        ++framesSent;
+        bytesSent += frame.size();
+        for (const std::string& pending : backlog) {
+            if (!sendFrame(fd, pending, MSG_DONTWAIT)) {
+                close(fd);
+                ++disconnected;
+                return;
+            }
+            ++framesSent;
+            bytesSent += pending.size();
+        }
+        followers.push_back(fd);
+#else
+        (void)fd;
+#endif
+    }
+
+    void serve() {
+#if defined(__linux__)
+        while (!stopping.load()) {
+            pollfd pending{listenFd, POLLIN, 0};
+            if (poll(&pending, 1, 100) > 0) {
+                const int fd = accept(listenFd, nullptr, nullptr);
+                if (fd >= 0) {
+                    bootstrap(fd);
+                }
+                continue;
+            }
+            std::lock_guard lock(mutex);
+            broadcast(ReplicationEncoder().finish({ReplicationFrame::Type::Heartbeat, 0, sequence, replicationNow()}));
+        }
+#endif
+    }
+
+public:
+    explicit ReplicationPrimary(std::string socketPath) : path(std::move(socketPath)) {
+#if defined(__linux__)
+        const sockaddr_un address = replicationAddress(path);
+        reclaimSocketPath(path);
+        listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listenFd < 0 || bind(listenFd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 ||
+            listen(listenFd, 16) != 0) {
+            const std::string reason = std::strerror(errno);
+            if (listenFd >= 0) {
+                close(listenFd);
+            }
+            throw std::runtime_error("Cannot listen on " + path + ": " + reason);
+        }
+        acceptor = std::thread(&ReplicationPrimary::serve, this);
+#else
+        throw std::runtime_error("Replication needs Linux");
+#endif
+    }
+
+    ReplicationPrimary(const ReplicationPrimary&) = delete;
+    ReplicationPrimary& operator=(const ReplicationPrimary&) = delete;
+
+    void changed(std::span<const AnimalChange> batch) override {
+        ReplicationEncoder encoder;
+        encoder.putChanges(batch);
+        std::lock_guard lock(mutex);
+        AnimalRosterObserver::changed(batch);
+        broadcast(std::move(encoder).finish({ReplicationFrame::Type::Batch, 0, ++sequence, replicationNow()}));
+    }
+
+    void reportMetrics() const override {
+        std::lock_guard lock(mutex);
+        LogLine() << "Replication primary " << path << ": sequence " << sequence << ", " << followers.size()
+                  << " followers (" << accepted << " bootstrapped, " << disconnected << " disconnected), "
+                  << framesSent << " frames / " << bytesSent << " bytes sent";
+    }
+
+    ~ReplicationPrimary() override {
+#if defined(__linux__)
+        stopping.store(true);
+        acceptor.join();
+        for (int fd : followers) {
+            close(fd);
+        }
+        close(listenFd);
+        unlink(path.c_str());
+#endif
+    }
+};
+
+// Follower side: tails the primary's stream on a background thread and serves reads from its mirror
+// under a shared lock, so any number of reader threads can query it at once. Reads are refused once
+// the last frame is older than the staleness bound.
+class ReplicaStore : public AnimalRosterObserver {
+private:
+    using Clock = std::chrono::steady_clock;
+
+    std::string path;
+    std::chrono::milliseconds maxStaleness;
+    mutable std::shared_mutex mutex;
+    std::atomic<std::int64_t> lastContact{0};
+    std::atomic<std::uint64_t> sequence{0};
+    std::atomic<std::uint64_t> batches{0};
+    std::atomic<std::uint64_t> bytesReceived{0};
+    std::atomic<std::uint64_t> snapshots{0};
+    std::atomic<std::int64_t> lastLag{0};
+    std::atomic<std::int64_t> maxLag{0};
+    std::atomic<int> connection{-1};
+    std::atomic<bool> stopping{false};
+    const std::int64_t started = replicationNow();
+    std::thread receiver;
+
+    // Applies one frame; returns false when the stream has a gap and must be re-bootstrapped.
+    bool apply(const ReplicationFrame& frame, std::string_view payload) {
+        WireDecoder decoder(payload);
+        switch (frame.type) {
+        case ReplicationFrame::Type::Snapshot: {
+            std::vector<AnimalChange> entries(decoder.getCount(sizeof(AnimalKind) + sizeof(std::uint32_t)));
+            for (std::size_t i = 0; i < entries.size(); ++i) {
+                const AnimalKind kind = decoder.getKind();
+                entries[i] = AnimalAdded{static_cast<std::uint32_t>(i),
+                                         animalKinds[static_cast<std::size_t>(kind)].create(
+                                             std::string(decoder.getName()))};
+            }
+            std::unique_lock lock(mutex);
+            roster.clear();
+            AnimalRosterObserver::changed(entries);
+            ++snapshots;
+            break;
+        }
+        case ReplicationFrame::Type::Batch: {
+            if (frame.sequence != sequence.load() + 1) {
+                return false;
+            }
+            const std::vector<AnimalChange> batch = decoder.getChanges();
+            std::unique_lock lock(mutex);
+            if (!AnimalRosterObserver::fits(batch, roster.size())) {
+                return false;
+            }
+            AnimalRosterObserver::changed(batch);
+            ++batches;
+            break;
+        }
+        case ReplicationFrame::Type::Heartbeat:
+            if (frame.sequence != sequence.load()) {
+                return false;
+            }
+            break;
+        default:
+            return false;
+        }
+        const std::int64_t now = replicationNow();
+        sequence.store(frame.sequence);
+        lastContact.store(now);
+        bytesReceived += sizeof(frame) + payload.size();
+        if (frame.type != ReplicationFrame::Type::Heartbeat) {
+            lastLag.store(now - frame.sentNanos);
+            maxLag.store(std::max(maxLag.load(), now - frame.sentNanos));
+        }
+        return true;
+    }
+
+    void follow() {
+#if defined(__linux__)
+        const sockaddr_un address = replicationAddress(path);
+        std::string payload;
+        while (!stopping.load()) {
+            const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            connection.store(fd);
+            if (fd >= 0 && connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0) {
+                ReplicationFrame frame{};
+                try {
+                    while (receiveExactly(fd, reinterpret_cast<char*>(&frame), sizeof(frame))) {
+                        if (frame.length > ReplicationFrame::MaxLength) {
+                            break;
+                        }
+                        payload.resize(frame.length);
+                        if (!receiveExactly(fd, payload.data(), payload.size()) || !apply(frame, payload)) {
+                            break;
+                        }
+                    }
+                } catch (const std::runtime_error&) {
+                }
+            }
+            connection.store(-1);
+            if (fd >= 0) {
+                close(fd);
+            }
+            if (!stopping.load()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            }
+        }
+#endif
+    }
+
+public:
+    ReplicaStore(std::string socketPath, std::chrono::milliseconds staleness)
+        : path(std::move(socketPath)), maxStaleness(staleness) {
+#if defined(__linux__)
+        replicationAddress(path);
+        receiver = std::thread(&ReplicaStore::follow, this);
+#else
+        throw std::runtime_error("Replication needs Linux");
+#endif
+    }
+
+    ReplicaStore(const ReplicaStore&) = delete;
+    ReplicaStore& operator=(const ReplicaStore&) = delete;
+
+    [[nodiscard]] std::chrono::milliseconds staleness() const {
+        const std::int64_t contact = lastContact.load();
+        if (contact == 0) {
+            return std::chrono::milliseconds::max();
+        }
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::nanoseconds(replicationNow() - contact));
+    }
+
+    [[nodiscard]] bool fresh() const {
+        return staleness() <= maxStaleness;
+    }
+
+    [[nodiscard]] std::chrono::milliseconds stalenessBound() const {
+        return maxStaleness;
+    }
+
+    [[nodiscard]] AnimalQuery<ReplicaStore> query() const {
+        return AnimalQuery<ReplicaStore>(*this);
+    }
+
+    template <typename Emit>
+    void executeQuery(const QuerySpec& spec, Emit emit) const {
+        std::shared_lock lock(mutex);
+        finishQuery(spec, [this](auto visit) {
+            for (std::size_t i = 0; i < roster.size() && visit(i); ++i) {
+            }
+        }, [this](std::size_t slot) { return roster[slot].kind; },
+           [this](std::size_t slot) { return std::string_view(roster[slot].name); }, emit);
+    }
+
+    [[nodiscard]] std::string renderQuery(const QuerySpec& spec) const {
+        std::string out;
+        executeQuery(spec, [&out](AnimalKind kind, std::string_view name) { appendDisplayRow(out, kind, name); });
+        return out;
+    }
+
+    [[nodiscard]] std::string renderInfo(AnimalKind kind) const {
+        std::vector<std::string_view> names;
+        std::shared_lock lock(mutex);
+        for (const Entry& entry : roster) {
+            if (entry.kind == kind) {
+                names.push_back(entry.name);
+            }
+        }
+        std::string out;
+        std::vector<std::size_t> ends(names.size());
+        animalKinds[static_cast<std::size_t>(kind)].infoNames(names, out, ends);
+        return out;
+    }
+
+    void reportMetrics() const override {
+        std::size_t animals = 0;
+        {
+            std::shared_lock lock(mutex);
+            animals = roster.size();
+        }
+        const double seconds = static_cast<double>(replicationNow() - started) / 1e9;
+        const auto staleMs = staleness();
+        LogLine() << "Replica of " << path << ": sequence " << sequence.load() << ", " << animals << " animals, "
+                  << (connection.load() >= 0 ? "connected" : "disconnected") << ", " << snapshots.load()
+                  << " snapshots";
+        LogLine() << "  lag last " << lastLag.load() / 1000 << " us, max " << maxLag.load() / 1000 << " us; "
+                  << batches.load() << " batches (" << std::fixed << std::setprecision(1)
+                  << static_cast<double>(batches.load()) / seconds << "/s), " << bytesReceived.load()
+                  << " bytes; last contact "
+                  << (staleMs == std::chrono::milliseconds::max() ? std::string("never")
+                                                                  : std::to_string(staleMs.count()) + " ms ago");
+    }
+
+    ~ReplicaStore() override {
+#if defined(__linux__)
+        stopping.store(true);
+        if (const int fd = connection.load(); fd >= 0) {
+            shutdown(fd, SHUT_RDWR);
+        }
+        receiver.join();
+#endif
+    }
+};
+
+// Partitioned deployment: worker processes each own the names that hash onto their share of a
+// consistent-hash ring and serve requests over a Unix socket; the router forwards commands to them.
+// Every request and response is a PartitionFrame followed by its payload, and mutating responses
+// end with the worker's change batch.
+struct PartitionFrame {
+    enum class Op : std::uint32_t {
+        Add = 1,
+        RemoveName,
+        RemoveKind,
+        Sort,
+        Find,
+        Query,
+        Display,
+        Info,
+        Counts,
+        Collect,
+        RemoveNames
+    };
+
+    // Longer frames are treated as a corrupt stream rather than allocated.
+    static constexpr std::uint32_t MaxLength = 1u << 28;
+
+    Op op;
+    std::uint32_t length;
+};
+
+using PartitionEncoder = WireEncoder<PartitionFrame>;
+
+// FNV-1a with a murmur finalizer: stable across processes, unlike std::hash, and well spread even for
+// the short keys the virtual nodes use.
+inline std::uint64_t partitionHash(std::string_view key) {
+    std::uint64_t hash = 0xcbf29ce484222325;
+    for (const unsigned char c : key) {
+        hash = (hash ^ c) * 0x100000001b3;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccd;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// Consistent-hash ring with virtual nodes. A point owns the hashes between its predecessor
+// (exclusive) and itself (inclusive), wrapping around at the top.
+class PartitionRing {
+public:
+    struct Range {
+        std::uint64_t first;
+        std::uint64_t last;
+    };
+    static constexpr std::uint32_t VirtualNodes = 64;
+
+private:
+    std::vector<std::pair<std::uint64_t, std::uint32_t>> points;
+
+public:
+    void add(std::uint32_t worker, std::string_view key) {
+        for (std::uint32_t node = 0; node < VirtualNodes; ++node) {
+            points.emplace_back(partitionHash(std::string(key) + "#" + std::to_string(node)), worker);
+        }
+        std::ranges::sort(points);
+    }
+
+    [[nodiscard]] std::uint32_t owner(std::uint64_t hash) const {
+        const auto point = std::ranges::lower_bound(points, std::pair{hash, std::uint32_t{0}});
+        return point == points.end() ? points.front().second : point->second;
+    }
+
+    // Inclusive hash ranges owned by worker.
+    [[nodiscard]] std::vector<Range> rangesOf(std::uint32_t worker) const {
+        std::vector<Range> ranges;
+        for (std::size_t i = 0; i < points.size(); ++i) {
+            if (points[i].second != worker) {
+                continue;
+            }
+            if (i != 0) {
+                ranges.push_back({points[i - 1].first + 1, points[i].first});
+                continue;
+            }
+            if (points.back().first != std::numeric_limits<std::uint64_t>::max()) {
+                ranges.push_back({points.back().first + 1, std::numeric_limits<std::uint64_t>::max()});
+            }
+            ranges.push_back({0, points[i].first});
+        }
+        return ranges;
+    }
+};
+
+inline void putQuerySpec(PartitionEncoder& out, const QuerySpec& spec) {
+    out.put(static_cast<std::uint8_t>(spec.kind.has_value()));
+    out.put(spec.kind.value_or(AnimalKind::Dog));
+    for (const auto* names : {&spec.nameEquals, &spec.namePrefixes}) {
+        out.put(static_cast<std::uint32_t>(names->size()));
+        for (const std::string& name : *names) {
+            out.putName(name);
+        }
+    }
+    out.put(static_cast<std::uint8_t>(spec.empty));
+    out.put(static_cast<std::uint8_t>(spec.order ? static_cast<int>(*spec.order) + 1 : 0));
+    out.put(static_cast<std::uint64_t>(spec.limit));
+}
+
+inline QuerySpec getQuerySpec(WireDecoder& in) {
+    QuerySpec spec;
+    const bool hasKind = in.get<std::uint8_t>() != 0;
+    const AnimalKind kind = in.getKind();
+    if (hasKind) {
+        spec.kind = kind;
+    }
+    for (auto* names : {&spec.nameEquals, &spec.namePrefixes}) {
+        names->resize(in.getCount(sizeof(std::uint32_t)));
+        for (std::string& name : *names) {
+            name = in.getName();
+        }
+    }
+    spec.empty = in.get<std::uint8_t>() != 0;
+    if (const auto order = in.get<std::uint8_t>(); order != 0) {
+        spec.order = static_cast<QueryOrder>(order - 1);
+    }
+    spec.limit = static_cast<std::size_t>(in.get<std::uint64_t>());
+    return spec;
+}
+
+#if defined(__linux__)
+inline volatile std::sig_atomic_t partitionWorkerStop = 0;
+
+// Serves one partition until SIGINT or SIGTERM. Requests are handled one at a time in arrival
+// order, which is all the router needs: it keeps at most one request in flight per worker.
+int runPartitionWorker(const std::string& path) {
+    ColumnarAnimalContainer container;
+    container.trackChanges(true);
+    const sockaddr_un address = replicationAddress(path);
+    reclaimSocketPath(path);
+    const int listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFd < 0 || bind(listenFd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(listenFd, 16) != 0) {
+        throw std::runtime_error("Cannot listen on " + path + ": " + std::strerror(errno));
+    }
+    std::signal(SIGINT, [](int) { partitionWorkerStop = 1; });
+    std::signal(SIGTERM, [](int) { partitionWorkerStop = 1; });
+    DiagnosticLine() << "Partition worker listening on " << path;
+
+    const auto handle = [&container](PartitionFrame::Op op, WireDecoder& in, PartitionEncoder& out) {
+        bool mutated = true;
+        switch (op) {
+        case PartitionFrame::Op::Add:
+            for (auto count = in.get<std::uint32_t>(); count != 0; --count) {
+                const AnimalKind kind = in.getKind();
+                container.addAnimal(animalKinds[static_cast<std::size_t>(kind)].create(std::string(in.getName())));
+            }
+            break;
+        case PartitionFrame::Op::RemoveName:
+            out.put(static_cast<std::uint32_t>(container.removeAnimalByName(in.getName())));
+            break;
+        case PartitionFrame::Op::RemoveKind:
+            container.removeAnimal(std::string(animalKinds[static_cast<std::size_t>(in.getKind())].type));
+            break;
+        case PartitionFrame::Op::Sort:
+            container.sortAnimals();
+            break;
+        case PartitionFrame::Op::Find: {
+            const auto animal = container.findAnimal(in.getName());
+            out.put(static_cast<std::uint8_t>(animal != nullptr));
+            out.put(animal ? animal->getKind() : AnimalKind::Dog);
+            mutated = false;
+            break;
+        }
+        case PartitionFrame::Op::Query: {
+            std::uint32_t rows = 0;
+            PartitionEncoder listing;
+            container.executeQuery(getQuerySpec(in), [&](AnimalKind kind, std::string_view name) {
+                listing.put(kind);
+                listing.putName(name);
+                ++rows;
+            });
+            out.put(rows);
+            out.putBytes(std::move(listing).payload());
+            mutated = false;
+            break;
+        }
+        case PartitionFrame::Op::Display:
+            out.putName(container.renderDisplay());
+            mutated = false;
+            break;
+        case PartitionFrame::Op::Info:
+            out.putName(container.renderInfo(std::string(animalKinds[static_cast<std::size_t>(in.getKind())].type)));
+            mutated = false;
+            break;
+        case PartitionFrame::Op::Counts: {
+            std::array<std::uint64_t, AnimalKindCount> perKind{};
+            container.executeQuery(QuerySpec{}, [&perKind](AnimalKind kind, std::string_view) {
+                ++perKind[static_cast<std::size_t>(kind)];
+            });
+            for (std::uint64_t count : perKind) {
+                out.put(count);
+            }
+            mutated = false;
+            break;
+        }
+        case PartitionFrame::Op::Collect: {
+            // Lists the animals of up to `limit` distinct names whose hash falls in the requested
+            // ranges. Nothing is removed: the router sends RemoveNames once the new owner has them.
+            std::vector<PartitionRing::Range> ranges(in.getCount(sizeof(PartitionRing::Range)));
+            for (auto& range : ranges) {
+                range = in.get<PartitionRing::Range>();
+            }
+            const auto limit = in.get<std::uint32_t>();
+            std::vector<std::string> names;
+            std::vector<AnimalKind> kinds;
+            std::unordered_set<std::string_view> distinct;
+            bool more = false;
+            container.executeQuery(QuerySpec{}, [&](AnimalKind kind, std::string_view name) {
+                const std::uint64_t hash = partitionHash(name);
+                if (!std::ranges::any_of(ranges, [hash](const auto& r) { return r.first <= hash && hash <= r.last; })) {
+                    return;
+                }
+                if (!distinct.contains(name)) {
+                    if (distinct.size() == limit) {
+                        more = true;
+                        return;
+                    }
+                    // Keys view the container's arena, which nothing changes during the query.
+                    distinct.insert(name);
+                }
+                names.emplace_back(name);
+                kinds.push_back(kind);
+            });
+            out.put(static_cast<std::uint8_t>(more));
+            out.put(static_cast<std::uint32_t>(names.size()));
+            for (std::size_t i = 0; i < names.size(); ++i) {
+                out.put(kinds[i]);
+                out.putName(names[i]);
+            }
+            mutated = false;
+            break;
+        }
+        case PartitionFrame::Op::RemoveNames:
+            for (std::size_t count = in.getCount(sizeof(std::uint32_t)); count != 0; --count) {
+                container.removeAnimalByName(in.getName());
+            }
+            break;
+        default:
+            throw std::runtime_error("Unknown partition request");
+        }
+        if (mutated) {
+            out.putChanges(container.takeChanges());
+        }
+    };
+
+    std::vector<pollfd> fds{{listenFd, POLLIN, 0}};
+    std::string payload;
+    while (partitionWorkerStop == 0) {
+        if (poll(fds.data(), fds.size(), 200) <= 0) {
+            continue;
+        }
+        if (fds[0].revents & POLLIN) {
+            if (const int fd = accept(listenFd, nullptr, nullptr); fd >= 0) {
+                fds.push_back({fd, POLLIN, 0});
+            }
+        }
+        for (std::size_t i = 1; i < fds.size(); ++i) {
+            if (fds[i].revents == 0) {
+                continue;
+            }
+            PartitionFrame request{};
+            bool ok = receiveExactly(fds[i].fd, reinterpret_cast<char*>(&request), sizeof(request)) &&
+                      request.length <= PartitionFrame::MaxLength;
+            if (ok) {
+                payload.resize(request.length);
+                ok = receiveExactly(fds[i].fd, payload.data(), payload.size());
+            }
+            if (ok) {
+                PartitionEncoder response;
+                try {
+                    WireDecoder in(payload);
+                    handle(request.op, in, response);
+                    ok = sendFrame(fds[i].fd, std::move(response).finish({request.op, 0}), 0);
+                } catch (const std::runtime_error& e) {
+                    DiagnosticLine() << "Dropping client: " << e.what();
+                    ok = false;
+                }
+            }
+            if (!ok) {
+                close(fds[i].fd);
+                fds[i].fd = -1;
+            }
+        }
+        std::erase_if(fds, [](const pollfd& entry) { return entry.fd < 0; });
+        container.compactFor(std::chrono::microseconds(500));
+    }
+    for (const pollfd& entry : fds) {
+        close(entry.fd);
+    }
+    unlink(path.c_str());
+    DiagnosticLine() << "Partition worker on " << path << " stopped";
+    return 0;
+}
+#endif
+
+// Router facade with the AnimalContainer interface, so runMenu drives a partitioned deployment
+// unchanged. Its display order is the workers' orders concatenated in the order the workers were
+// added; worker change batches are shifted into that order before observers see them.
+class PartitionedAnimalContainer : public AnimalContainerBase {
+private:
+    struct Worker {
+        std::string path;
+        int fd = -1;
+        std::size_t size = 0;
+        std::uint64_t requests = 0;
+        std::uint64_t bytes = 0;
+    };
+
+    // One slice of a migration: the animals collected from the source, and whether the target has
+    // acknowledged them yet.
+    struct Slice {
+        PartitionEncoder rows;
+        PartitionEncoder names;
+        std::uint32_t animals = 0;
+        bool more = false;
+        bool added = false;
+    };
+
+    // Moving the names a new worker took over from the others, one bounded slice at a time.
+    struct Migration {
+        std::uint32_t target;
+        std::vector<PartitionRing::Range> ranges;
+        std::uint32_t source = 0;
+        PartitionRing previous;
+        // A slice whose copy or removal failed; it is finished before the next one is collected.
+        std::optional<Slice> pending;
+    };
+
+    mutable std::mutex mutex;
+    mutable std::vector<Worker> workers;
+    PartitionRing ring;
+    std::optional<Migration> migration;
+    std::uint64_t migrated = 0;
+    // Set by sortAnimals while every partition is still in (type, name) order; displayAll then merges.
+    mutable bool sorted = false;
+    // Mutable because a const query may reconnect a worker, which has to announce its contents.
+    mutable AnimalChangeLog changes;
+
+    // A worker whose stream broke or timed out is closed and marked with fd -1: a late reply could
+    // otherwise be read as the answer to the next request.
+    void fail(std::uint32_t worker) const {
+#if defined(__linux__)
+        close(workers[worker].fd);
+#endif
+        workers[worker].fd = -1;
+    }
+
+    // A failed worker is redialled on its next request. It may have come back with other contents,
+    // e.g. empty after a crash, so observers see its old range removed and what it holds now added.
+    void reconnect(std::uint32_t worker) const {
+        Worker& target = workers[worker];
+        target.fd = openSocket(target.path);
+        std::size_t base = 0;
+        for (std::uint32_t i = 0; i < worker; ++i) {
+            base += workers[i].size;
+        }
+        const std::size_t before = target.size;
+        PartitionEncoder request;
+        putQuerySpec(request, QuerySpec{});
+        const std::string reply = call(worker, std::move(request), PartitionFrame::Op::Query);
+        if (before != 0) {
+            AnimalsRemoved lost;
+            for (std::size_t position = base; position < base + before; ++position) {
+                lost.positions.push_back(static_cast<std::uint32_t>(position));
+            }
+            changes.record(std::move(lost));
+        }
+        WireDecoder in(reply);
+        target.size = 0;
+        sorted = false;
+        for (auto count = in.get<std::uint32_t>(); count != 0; --count) {
+            const AnimalKind kind = in.getKind();
+            changes.record(AnimalAdded{static_cast<std::uint32_t>(base + target.size++),
+                                       animalKinds[static_cast<std::size_t>(kind)].create(std::string(in.getName()))});
+        }
+        DiagnosticLine() << "Partition worker " << target.path << " reconnected with " << target.size << " animals"
+                         << (target.size != before ? " (was " + std::to_string(before) + ")" : std::string());
+    }
+
+    void send(std::uint32_t worker, const std::string& frame) const {
+#if defined(__linux__)
+        Worker& target = workers[worker];
+        if (target.fd < 0) {
+            try {
+                reconnect(worker);
+            } catch (const std::runtime_error& e) {
+                throw std::runtime_error("Partition worker " + target.path + " is unavailable: " + e.what());
+            }
+        }
+        if (!sendFrame(target.fd, frame, 0)) {
+            fail(worker);
+            throw std::runtime_error("Lost partition worker " + target.path);
+        }
+        ++target.requests;
+        target.bytes += frame.size();
+#else
+        (void)worker;
+        (void)frame;
+#endif
+    }
+
+    std::string receive(std::uint32_t worker) const {
+        std::string payload;
+#if defined(__linux__)
+        Worker& source = workers[worker];
+        PartitionFrame frame{};
+        bool ok = receiveExactly(source.fd, reinterpret_cast<char*>(&frame), sizeof(frame)) &&
+                  frame.length <= PartitionFrame::MaxLength;
+        if (ok) {
+            payload.resize(frame.length);
+            ok = receiveExactly(source.fd, payload.data(), payload.size());
+        }
+        if (!ok) {
+            fail(worker);
+            throw std::runtime_error("Lost partition worker " + source.path);
+        }
+        source.bytes += sizeof(frame) + payload.size();
+#else
+        (void)worker;
+#endif
+        return payload;
+    }
+
+    std::string call(std::uint32_t worker, PartitionEncoder request, PartitionFrame::Op op) const {
+        send(worker, std::move(request).finish({op, 0}));
+        return receive(worker);
+    }
+
+    // Sends the same request to every worker before reading any reply, so they work in parallel, and
+    // hands each reply to onReply(worker, reply). Every worker that took the request is read back even
+    // when another one failed, so the healthy streams stay in step and their changes are applied; the
+    // first failure is thrown once all replies are in.
+    template <typename OnReply>
+    void scatter(const PartitionEncoder& request, PartitionFrame::Op op, OnReply onReply) const {
+        const std::string frame = PartitionEncoder(request).finish({op, 0});
+        std::optional<std::runtime_error> failure;
+        std::vector<bool> sent(workers.size());
+        for (std::uint32_t worker = 0; worker < workers.size(); ++worker) {
+            try {
+                send(worker, frame);
+                sent[worker] = true;
+            } catch (const std::runtime_error& e) {
+                failure = failure.value_or(e);
+            }
+        }
+        for (std::uint32_t worker = 0; worker < workers.size(); ++worker) {
+            if (!sent[worker]) {
+                continue;
+            }
+            try {
+                onReply(worker, receive(worker));
+            } catch (const std::runtime_error& e) {
+                failure = failure.value_or(e);
+            }
+        }
+        if (failure) {
+            throw *failure;
+        }
+    }
+
+    // Shifts a worker's change batch from its local positions into the router's display order.
+    void applyChanges(std::uint32_t worker, WireDecoder& in) {
+        std::size_t base = 0;
+        std::size_t total = 0;
+        for (std::uint32_t i = 0; i < workers.size(); ++i) {
+            base += i < worker ? workers[i].size : 0;
+            total += workers[i].size;
+        }
+        std::size_t& size = workers[worker].size;
+        for (AnimalChange& change : in.getChanges()) {
+            if (auto* added = std::get_if<AnimalAdded>(&change)) {
+                added->position += static_cast<std::uint32_t>(base);
+                ++size;
+                ++total;
+            } else if (auto* removed = std::get_if<AnimalsRemoved>(&change)) {
+                for (std::uint32_t& position : removed->positions) {
+                    position += static_cast<std::uint32_t>(base);
+                }
+                size -= removed->positions.size();
+                total -= removed->positions.size();
+            } else if (auto* reordered = std::get_if<AnimalsReordered>(&change)) {
+                AnimalsReordered global;
+                if (base != 0) {
+                    global.runs.push_back({0, static_cast<std::uint32_t>(base)});
+                }
+                for (const auto& run : reordered->runs) {
+                    global.runs.push_back({static_cast<std::uint32_t>(run.from + base), run.length});
+                }
+                if (base + size < total) {
+                    global.runs.push_back({static_cast<std::uint32_t>(base + size),
+                                           static_cast<std::uint32_t>(total - base - size)});
+                }
+                change = std::move(global);
+            }
+            changes.record(std::move(change));
+        }
+    }
+
+    // Merges the workers' partitions, each already in (type, name) order, through a heap of one cursor
+    // per worker.
+    std::string renderMerged() const {
+        using Row = std::pair<AnimalKind, std::string>;
+        std::vector<std::vector<Row>> partitions(workers.size());
+        PartitionEncoder request;
+        putQuerySpec(request, QuerySpec{});
+        scatter(request, PartitionFrame::Op::Query, [&partitions](std::uint32_t worker, const std::string& reply) {
+            WireDecoder in(reply);
+            for (auto count = in.get<std::uint32_t>(); count != 0; --count) {
+                const AnimalKind kind = in.getKind();
+                partitions[worker].emplace_back(kind, in.getName());
+            }
+        });
+        using Cursor = std::pair<std::uint32_t, std::size_t>;
+        const auto rowAt = [&partitions](const Cursor& cursor) -> const Row& {
+            return partitions[cursor.first][cursor.second];
+        };
+        // The workers' sort order: kinds by kindSortRank, then names bytewise.
+        const auto later = [&rowAt](const Cursor& a, const Cursor& b) {
+            const Row& left = rowAt(a);
+            const Row& right = rowAt(b);
+            return std::pair(kindSortRank[static_cast<std::size_t>(right.first)], std::string_view(right.second)) <
+                   std::pair(kindSortRank[static_cast<std::size_t>(left.first)], std::string_view(left.second));
+        };
+        std::vector<Cursor> heap;
+        for (std::uint32_t worker = 0; worker < partitions.size(); ++worker) {
+            if (!partitions[worker].empty()) {
+                heap.emplace_back(worker, 0);
+            }
+        }
+        std::make_heap(heap.begin(), heap.end(), later);
+        std::string out;
+        while (!heap.empty()) {
+            std::pop_heap(heap.begin(), heap.end(), later);
+            Cursor& next = heap.back();
+            appendDisplayRow(out, rowAt(next).first, rowAt(next).second);
+            if (++next.second < partitions[next.first].size()) {
+                std::push_heap(heap.begin(), heap.end(), later);
+            } else {
+                heap.pop_back();
+            }
+        }
+        return out;
+    }
+
+    // Workers that may hold this name: its owner, and while a rebalance runs, its previous owner.
+    std::vector<std::uint32_t> ownersOf(std::string_view name) const {
+        const std::uint64_t hash = partitionHash(name);
+        std::vector<std::uint32_t> owners{ring.owner(hash)};
+        if (migration && migration->previous.owner(hash) != owners.front()) {
+            owners.push_back(migration->previous.owner(hash));
+        }
+        return owners;
+    }
+
+    static int openSocket(const std::string& path) {
+#if defined(__linux__)
+        const sockaddr_un address = replicationAddress(path);
+        const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0 || connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+            const std::string reason = std::strerror(errno);
+            if (fd >= 0) {
+                close(fd);
+            }
+            throw std::runtime_error("Cannot connect to partition worker " + path + ": " + reason);
+        }
+        const timeval timeout{5, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        return fd;
+#else
+        throw std::runtime_error("Partitioned mode needs Linux: " + path);
+#endif
+    }
+
+    void connectWorker(const std::string& path) {
+#if defined(__linux__)
+        Worker worker;
+        worker.path = path;
+        worker.fd = openSocket(path);
+        workers.push_back(std::move(worker));
+        const auto index = static_cast<std::uint32_t>(workers.size() - 1);
+        ring.add(index, path);
+        // A worker may already hold animals, e.g. after a router restart.
+        const std::string reply = call(index, {}, PartitionFrame::Op::Counts);
+        WireDecoder in(reply);
+        for (std::size_t kind = 0; kind < AnimalKindCount; ++kind) {
+            workers.back().size += static_cast<std::size_t>(in.get<std::uint64_t>());
+        }
+#else
+        throw std::runtime_error("Partitioned mode needs Linux: " + path);
+#endif
+    }
+
+    // Moves one slice of names to the migration target; returns whether the migration continues. The
+    // slice is copied to the target first and removed from the source only once the target has
+    // acknowledged it, so a failure on either side leaves every animal on at least one worker; the
+    // failed step is retried on the next call. Removal is idempotent, since new animals with these
+    // names go to the target, but a copy whose acknowledgement was lost is sent again.
+    bool migrateSlice(std::uint32_t sliceNames) {
+        Migration& active = *migration;
+        if (!active.pending) {
+            if (active.source == active.target) {
+                ++active.source;
+            }
+            if (active.source >= workers.size()) {
+                migration.reset();
+                return false;
+            }
+            PartitionEncoder collect;
+            collect.put(static_cast<std::uint32_t>(active.ranges.size()));
+            for (const auto& range : active.ranges) {
+                collect.put(range);
+            }
+            collect.put(sliceNames);
+            const std::string reply = call(active.source, std::move(collect), PartitionFrame::Op::Collect);
+            WireDecoder in(reply);
+            Slice slice;
+            slice.more = in.get<std::uint8_t>() != 0;
+            slice.animals = static_cast<std::uint32_t>(in.getCount(sizeof(AnimalKind) + sizeof(std::uint32_t)));
+            slice.rows.put(slice.animals);
+            std::vector<std::string_view> names;
+            for (std::uint32_t i = 0; i < slice.animals; ++i) {
+                slice.rows.put(in.getKind());
+                names.push_back(in.getName());
+                slice.rows.putName(names.back());
+            }
+            std::ranges::sort(names);
+            names.erase(std::unique(names.begin(), names.end()), names.end());
+            slice.names.put(static_cast<std::uint32_t>(names.size()));
+            for (const std::string_view name : names) {
+                slice.names.putName(name);
+            }
+            active.pending = std::move(slice);
+        }
+        Slice& slice = *active.pending;
+        if (slice.animals != 0) {
+            if (!slice.added) {
+                sorted = false;
+                const std::string addReply = call(active.target, slice.rows, PartitionFrame::Op::Add);
+                WireDecoder added(addReply);
+                applyChanges(active.target, added);
+                slice.added = true;
+            }
+            const std::string removeReply = call(active.source, slice.names, PartitionFrame::Op::RemoveNames);
+            WireDecoder removed(removeReply);
+            applyChanges(active.source, removed);
+            migrated += slice.animals;
+        }
+        if (!slice.more) {
+            ++active.source;
+        }
+        active.pending.reset();
+        return true;
+    }
+
+public:
+    explicit PartitionedAnimalContainer(const std::vector<std::string>& paths) {
+        for (const std::string& path : paths) {
+            connectWorker(path);
+        }
+        if (workers.empty()) {
+            throw std::runtime_error("Partitioned mode needs at least one worker");
+        }
+        ++instanceCount;
+    }
+
+    PartitionedAnimalContainer(const PartitionedAnimalContainer&) = delete;
+    PartitionedAnimalContainer& operator=(const PartitionedAnimalContainer&) = delete;
+
+    // Joins a worker to the ring. The names it now owns move over in slices from compactFor();
+    // until then lookups also try each name's previous owner.
+    void addWorker(const std::string& path) {
+        std::lock_guard lock(mutex);
+        while (migration) {
+            migrateSlice(std::numeric_limits<std::uint32_t>::max());
+        }
+        PartitionRing previous = ring;
+        connectWorker(path);
+        sorted = false;
+        const auto target = static_cast<std::uint32_t>(workers.size() - 1);
+        migration = Migration{target, ring.rangesOf(target), 0, std::move(previous), std::nullopt};
+    }
+
+    void addAnimal(const std::shared_ptr<Animal>& animal) {
+        std::lock_guard lock(mutex);
+        const std::uint32_t worker = ring.owner(partitionHash(animal->getName()));
+        PartitionEncoder request;
+        request.put(std::uint32_t{1});
+        request.put(animal->getKind());
+        request.putName(animal->getName());
+        sorted = false;
+        const std::string reply = call(worker, std::move(request), PartitionFrame::Op::Add);
+        WireDecoder in(reply);
+        applyChanges(worker, in);
+    }
+
+    // After a sort the listing is one k-way merge of the workers' ordered partitions; otherwise it is
+    // their rendered partitions in worker order.
+    void displayAll() const {
+        std::lock_guard lock(mutex);
+        std::string out;
+        if (sorted) {
+            out = renderMerged();
+        } else {
+            scatter({}, PartitionFrame::Op::Display, [&out](std::uint32_t, const std::string& reply) {
+                out += WireDecoder(reply).getName();
+            });
+        }
+        if (!out.empty()) {
+            LogSink::instance().write(std::move(out));
+        }
+    }
+
+    void removeAnimal(const std::string& name) {
+        const auto kind = kindFromType(name);
+        if (!kind) {
+            return;
+        }
+        std::lock_guard lock(mutex);
+        PartitionEncoder request;
+        request.put(*kind);
+        scatter(request, PartitionFrame::Op::RemoveKind, [this](std::uint32_t worker, const std::string& reply) {
+            WireDecoder in(reply);
+            applyChanges(worker, in);
+        });
+    }
+
+    std::size_t removeAnimalByName(std::string_view name) {
+        std::lock_guard lock(mutex);
+        std::size_t removed = 0;
+        for (std::uint32_t worker : ownersOf(name)) {
+            PartitionEncoder request;
+            request.putName(name);
+            const std::string reply = call(worker, std::move(request), PartitionFrame::Op::RemoveName);
+            WireDecoder in(reply);
+            removed += in.get<std::uint32_t>();
+            applyChanges(worker, in);
+        }
+        return removed;
+    }
+
+    void displayAnimalInfo(const std::string& name) const {
+        const auto kind = kindFromType(name);
+        if (!kind) {
+            return;
+        }
+        std::lock_guard lock(mutex);
+        PartitionEncoder request;
+        request.put(*kind);
+        std::string out;
+        scatter(request, PartitionFrame::Op::Info, [&out](std::uint32_t, const std::string& reply) {
+            out += WireDecoder(reply).getName();
+        });
+        if (!out.empty()) {
+            LogSink::instance().write(std::move(out));
+        }
+    }
+
+    // Every worker sorts its own partition in parallel; displayAll then merges the sorted partitions
+    // until the next addition or migration breaks their order. Observers still see positions in the
+    // concatenated worker order.
+    void sortAnimals() {
+        std::lock_guard lock(mutex);
+        scatter({}, PartitionFrame::Op::Sort, [this](std::uint32_t worker, const std::string& reply) {
+            WireDecoder in(reply);
+            applyChanges(worker, in);
+        });
+        sorted = true;
+    }
+
+    [[nodiscard]] std::shared_ptr<Animal> findAnimal(std::string_view name) const {
+        std::lock_guard lock(mutex);
+        for (std::uint32_t worker : ownersOf(name)) {
+            PartitionEncoder request;
+            request.putName(name);
+            const std::string reply = call(worker, std::move(request), PartitionFrame::Op::Find);
+            WireDecoder in(reply);
+            const bool found = in.get<std::uint8_t>() != 0;
+            const AnimalKind kind = in.getKind();
+            if (found) {
+                return animalKinds[static_cast<std::size_t>(kind)].create(std::string(name));
+            }
+        }
+        return nullptr;
+    }
+
+    [[nodiscard]] std::vector<std::shared_ptr<Animal>> lookupMany(std::span<const std::string_view> names) const {
+        std::vector<std::shared_ptr<Animal>> found;
+        found.reserve(names.size());
+        for (std::string_view name : names) {
+            found.push_back(findAnimal(name));
+        }
+        return found;
+    }
+
+    [[nodiscard]] AnimalQuery<PartitionedAnimalContainer> query() const {
+        return AnimalQuery<PartitionedAnimalContainer>(*this);
+    }
+
+    // Scatter-gather: every worker filters, orders and limits its own partition, and the router
+    // merges the partial results through the same query pipeline.
+    template <typename Emit>
+    void executeQuery(const QuerySpec& spec, Emit emit) const {
+        std::vector<std::pair<AnimalKind, std::string>> rows;
+        {
+            std::lock_guard lock(mutex);
+            PartitionEncoder request;
+            putQuerySpec(request, spec);
+            scatter(request, PartitionFrame::Op::Query, [&rows](std::uint32_t, const std::string& reply) {
+                WireDecoder in(reply);
+                for (auto count = in.get<std::uint32_t>(); count != 0; --count) {
+                    const AnimalKind kind = in.getKind();
+                    rows.emplace_back(kind, in.getName());
+                }
+            });
+        }
+        finishQuery(spec, [&rows](auto visit) {
+            for (std::size_t i = 0; i < rows.size() && visit(i); ++i) {
+            }
+        }, [&rows](std::size_t slot) { return rows[slot].first; },
+           [&rows](std::size_t slot) { return std::string_view(rows[slot].second); }, emit);
+    }
+
+    [[nodiscard]] std::string renderQuery(const QuerySpec& spec) const {
+        std::string out;
+        executeQuery(spec, [&out](AnimalKind kind, std::string_view name) { appendDisplayRow(out, kind, name); });
+        return out;
+    }
+
+    // Spends the budget moving names to a newly added worker.
+    bool compactFor(std::chrono::microseconds budget) {
+        constexpr std::uint32_t namesPerSlice = 256;
+        std::lock_guard lock(mutex);
+        const auto deadline = std::chrono::steady_clock::now() + budget;
+        while (migration && std::chrono::steady_clock::now() < deadline) {
+            migrateSlice(namesPerSlice);
+        }
+        return migration.has_value();
+    }
+
+    void reportMetrics() const {
+        std::lock_guard lock(mutex);
+        LogLine() << "Partitioned storage: " << workers.size() << " workers, " << PartitionRing::VirtualNodes
+                  << " virtual nodes each, " << migrated << " animals migrated"
+                  << (migration ? ", rebalance in progress" : "");
+        scatter({}, PartitionFrame::Op::Counts, [this](std::uint32_t worker, const std::string& reply) {
+            WireDecoder in(reply);
+            const auto dogs = in.get<std::uint64_t>();
+            const auto cats = in.get<std::uint64_t>();
+            LogLine() << "  worker " << workers[worker].path << ": " << dogs + cats << " animals (" << dogs
+                      << " dogs, " << cats << " cats), " << workers[worker].requests << " requests, "
+                      << workers[worker].bytes << " bytes";
+        });
+    }
+
+    void trackChanges(bool on) {
+        std::lock_guard lock(mutex);
+        changes.track(on);
+    }
+
+    [[nodiscard]] std::vector<AnimalChange> takeChanges() {
+        std::lock_guard lock(mutex);
+        return changes.take();
+    }
+
+    ~PartitionedAnimalContainer() {
+#if defined(__linux__)
+        for (const Worker& worker : workers) {
+            if (worker.fd >= 0) {
+                close(worker.fd);
+            }
+        }
+#endif
+        --instanceCount;
+    }
+};
+
+// On-disk layout of a MappedAnimalContainer. Everything in the file refers to everything else by
+// offset from the start of the mapping, so the file can be mapped at any address and reopening it is
+// just mmap plus a header check. Regions come in power-of-two size classes, recycled through
+// per-class free lists, and carry their own sizes, so replacing one is a single store of its
+// reference in the header.
+struct MappedLayout {
+    static constexpr std::uint64_t Magic = 0x3150414d4d494e41; // "ANIMMAP1"
+    static constexpr std::uint32_t Version = 1;
+    static constexpr std::uint32_t NoSlot = ~std::uint32_t{0};
+    static constexpr std::size_t SizeClasses = 48;
+
+    enum class State : std::uint32_t { Clean, Dirty };
+
+    // Position of a T relative to the start of the mapping.
+    template <typename T>
+    struct Ref {
+        std::uint64_t offset = 0;
+
+        [[nodiscard]] T* in(std::byte* base) const {
+            return reinterpret_cast<T*>(base + offset);
+        }
+    };
+
+    struct Slot {
+        Ref<const char> name;
+        std::uint32_t nameLength;
+        std::uint32_t next; // next slot in the same index bucket
+        AnimalKind kind;
+        std::uint8_t live;
+    };
+
+    // Followed by capacity slots, count of them in use.
+    struct SlotRegion {
+        std::uint64_t capacity;
+        std::uint64_t count;
+    };
+
+    // Followed by buckets chain heads.
+    struct IndexRegion {
+        std::uint64_t buckets;
+    };
+
+    // Followed by capacity name bytes. Outgrown arenas stay in place, since names still point there.
+    struct ArenaRegion {
+        std::uint64_t capacity;
+        std::uint64_t used;
+    };
+
+    struct Header {
+        std::uint64_t magic;
+        std::uint32_t version;
+        State state;
+        std::uint64_t allocated;
+        std::uint64_t freeBytes;
+        std::uint64_t checkpoints;
+        std::uint64_t liveCount;
+        std::uint64_t nameBytes;
+        std::uint64_t nameGarbage;
+        Ref<SlotRegion> slots;
+        Ref<IndexRegion> index;
+        Ref<ArenaRegion> arena;
+        // Each free region starts with the reference to the next one in its class.
+        std::array<Ref<std::byte>, SizeClasses> freeRegions;
+    };
+
+    static_assert(std::is_trivially_copyable_v<Slot> && sizeof(Slot) == 24);
+    static_assert(std::atomic_ref<std::uint64_t>::is_always_lock_free);
+    static_assert(sizeof(Header) <= 4096);
+};
+
+// Persistent container living entirely in a memory-mapped file; restarting maps the file and goes.
+//
+// Crash consistency: each mutation writes its data first and then makes it visible with one aligned
+// release store (a slot count, a live flag or a region reference), so a process dying mid-command
+// leaves slots and names consistent. The name index and live count are derived data and are
+// rebuilt on open whenever the header says Dirty. The header turns Dirty, synchronously, before the
+// first mutation after a checkpoint, and checkpoint() msyncs the whole file before marking it Clean.
+// A kernel crash or power loss may persist writes made since the last checkpoint in any order, so
+// recovery also drops slots whose kind or name points outside the file; checkpoint to bound that.
+class MappedAnimalContainer : public AnimalContainerBase {
+private:
+    using Layout = MappedLayout;
+    using Slot = Layout::Slot;
+
+    static constexpr std::size_t InitialBytes = std::size_t{1} << 20;
+    static constexpr std::uint64_t InitialSlots = 1024;
+    static constexpr std::uint64_t InitialArena = 64 * 1024;
+    static constexpr std::size_t HeaderBytes = 4096;
+
+    std::string path;
+    int fd = -1;
+    std::byte* base = nullptr;
+    std::size_t mappedBytes = 0;
+    AnimalChangeLog changes;
+    std::uint64_t remaps = 0;
+    std::uint64_t vacuums = 0;
+    std::chrono::microseconds openTime{0};
+    std::chrono::microseconds lastCheckpoint{0};
+
+    template <typename T>
+    static void publish(T& field, T value) {
+        std::atomic_ref<T>(field).store(value, std::memory_order_release);
+    }
+
+    static std::uint64_t slotRegionBytes(std::uint64_t capacity) {
+        return sizeof(Layout::SlotRegion) + capacity * sizeof(Slot);
+    }
+
+    static std::uint64_t slotsFitting(std::uint64_t bytes) {
+        return (bytes - sizeof(Layout::SlotRegion)) / sizeof(Slot);
+    }
+
+    static std::uint64_t indexRegionBytes(std::uint64_t buckets) {
+        return sizeof(Layout::IndexRegion) + buckets * sizeof(std::uint32_t);
+    }
+
+    static std::uint64_t bucketsFor(std::uint64_t animals) {
+        return std::bit_ceil(std::max<std::uint64_t>(animals, InitialSlots));
+    }
+
+    [[nodiscard]] Layout::Header& header() const {
+        return *reinterpret_cast<Layout::Header*>(base);
+    }
+
+    [[nodiscard]] Layout::SlotRegion& slotRegion() const {
+        return *header().slots.in(base);
+    }
+
+    [[nodiscard]] Slot* slots() const {
+        return reinterpret_cast<Slot*>(&slotRegion() + 1);
+    }
+
+    [[nodiscard]] std::uint64_t slotCount() const {
+        return slotRegion().count;
+    }
+
+    [[nodiscard]] std::uint32_t* heads() const {
+        return reinterpret_cast<std::uint32_t*>(header().index.in(base) + 1);
+    }
+
+    [[nodiscard]] std::size_t bucketOf(std::string_view name) const {
+        return static_cast<std::size_t>(partitionHash(name) & (header().index.in(base)->buckets - 1));
+    }
+
+    [[nodiscard]] std::string_view nameOf(const Slot& slot) const {
+        return {slot.name.in(base), slot.nameLength};
+    }
+
+    template <typename Fn>
+    void forEachLive(Fn fn) const {
+        const Slot* all = slots();
+        for (std::uint64_t i = 0, count = slotCount(); i < count; ++i) {
+            if (all[i].live && !fn(static_cast<std::size_t>(i))) {
+                return;
+            }
+        }
+    }
+
+    // Visits live slots with this name until fn returns false.
+    template <typename Fn>
+    void forEachNamed(std::string_view name, Fn fn) const {
+        for (std::uint32_t i = heads()[bucketOf(name)]; i != Layout::NoSlot; i = slots()[i].next) {
+            if (slots()[i].live && nameOf(slots()[i]) == name && !fn(static_cast<std::size_t>(i))) {
+                return;
+            }
+        }
+    }
+
+    void grow(std::uint64_t needed) {
+#if defined(__linux__)
+        std::size_t bytes = mappedBytes;
+        while (bytes < needed) {
+            bytes *= 2;
+        }
+        if (ftruncate(fd, static_cast<off_t>(bytes)) != 0) {
+            throw std::runtime_error("Cannot grow " + path + ": " + std::strerror(errno));
+        }
+        void* moved = mremap(base, mappedBytes, bytes, MREMAP_MAYMOVE);
+        if (moved == MAP_FAILED) {
+            throw std::runtime_error("Cannot remap " + path + ": " + std::strerror(errno));
+        }
+        base = static_cast<std::byte*>(moved);
+        mappedBytes = bytes;
+        ++remaps;
+#else
+        (void)needed;
+#endif
+    }
+
+    struct Allocation {
+        std::uint64_t offset;
+        std::uint64_t bytes;
+    };
+
+    static unsigned sizeClass(std::uint64_t bytes) {
+        return static_cast<unsigned>(std::bit_width(std::max<std::uint64_t>(bytes, 64) - 1));
+    }
+
+    // Reuses a free region of the right class or bump-allocates at the end of the file. The mapping
+    // may move, so callers re-derive pointers afterwards.
+    Allocation allocate(std::uint64_t bytes) {
+        const unsigned size = sizeClass(bytes);
+        bytes = std::uint64_t{1} << size;
+        Layout::Ref<std::byte>& free = header().freeRegions[size];
+        if (free.offset != 0) {
+            const std::uint64_t offset = free.offset;
+            publish(free, *reinterpret_cast<Layout::Ref<std::byte>*>(base + offset));
+            header().freeBytes -= bytes;
+            return {offset, bytes};
+        }
+        const std::uint64_t offset = header().allocated;
+        if (offset + bytes > mappedBytes) {
+            grow(offset + bytes);
+        }
+        publish(header().allocated, offset + bytes);
+        return {offset, bytes};
+    }
+
+    // Only called once nothing refers to the region any more.
+    void release(std::uint64_t offset, std::uint64_t bytes) {
+        const unsigned size = sizeClass(bytes);
+        Layout::Ref<std::byte>& free = header().freeRegions[size];
+        *reinterpret_cast<Layout::Ref<std::byte>*>(base + offset) = free;
+        publish(free, Layout::Ref<std::byte>{offset});
+        header().freeBytes += std::uint64_t{1} << size;
+    }
+
+    // The first mutation after a checkpoint makes the Dirty state durable before touching anything.
+    void beginMutation() {
+        if (header().state == Layout::State::Dirty) {
+            return;
+        }
+        header().state = Layout::State::Dirty;
+#if defined(__linux__)
+        msync(base, HeaderBytes, MS_SYNC);
+#endif
+    }
+
+    Layout::Ref<const char> appendName(std::string_view name) {
+        Layout::ArenaRegion* arena = header().arena.in(base);
+        if (arena->used + name.size() > arena->capacity) {
+            const Allocation region =
+                allocate(sizeof(Layout::ArenaRegion) + std::max<std::uint64_t>(arena->capacity * 2, name.size()));
+            arena = new (base + region.offset) Layout::ArenaRegion{region.bytes - sizeof(Layout::ArenaRegion), 0};
+            publish(header().arena, Layout::Ref<Layout::ArenaRegion>{region.offset});
+        }
+        const std::uint64_t offset = header().arena.offset + sizeof(Layout::ArenaRegion) + arena->used;
+        std::memcpy(base + offset, name.data(), name.size());
+        publish(arena->used, arena->used + name.size());
+        header().nameBytes += name.size();
+        return {offset};
+    }
+
+    void reserveSlots(std::uint64_t needed) {
+        const std::uint64_t capacity = slotRegion().capacity;
+        if (needed <= capacity) {
+            return;
+        }
+        const Allocation region = allocate(slotRegionBytes(needed));
+        const std::uint64_t old = header().slots.offset;
+        auto* fresh = new (base + region.offset) Layout::SlotRegion{slotsFitting(region.bytes), slotCount()};
+        std::memcpy(static_cast<void*>(fresh + 1), slots(), slotCount() * sizeof(Slot));
+        publish(header().slots, Layout::Ref<Layout::SlotRegion>{region.offset});
+        release(old, slotRegionBytes(capacity));
+    }
+
+    void rebuildIndex(std::uint64_t buckets) {
+        const Allocation region = allocate(indexRegionBytes(buckets));
+        auto* index = new (base + region.offset) Layout::IndexRegion{buckets};
+        auto* fresh = reinterpret_cast<std::uint32_t*>(index + 1);
+        std::fill_n(fresh, buckets, Layout::NoSlot);
+        Slot* all = slots();
+        for (std::uint64_t i = slotCount(); i-- > 0;) {
+            if (all[i].live) {
+                const std::size_t bucket = static_cast<std::size_t>(partitionHash(nameOf(all[i])) & (buckets - 1));
+                all[i].next = fresh[bucket];
+                fresh[bucket] = static_cast<std::uint32_t>(i);
+            }
+        }
+        const std::uint64_t old = header().index.offset;
+        const std::uint64_t oldBytes = indexRegionBytes(header().index.in(base)->buckets);
+        publish(header().index, Layout::Ref<Layout::IndexRegion>{region.offset});
+        release(old, oldBytes);
+    }
+
+    // Replaces the slot region with the given live slots in the given order.
+    void rewrite(std::span<const std::size_t> order) {
+        const Allocation region = allocate(slotRegionBytes(std::max<std::uint64_t>(order.size(), InitialSlots)));
+        auto* fresh = new (base + region.offset) Layout::SlotRegion{slotsFitting(region.bytes), order.size()};
+        Slot* target = reinterpret_cast<Slot*>(fresh + 1);
+        const Slot* source = slots();
+        for (std::size_t i = 0; i < order.size(); ++i) {
+            target[i] = source[order[i]];
+        }
+        const std::uint64_t old = header().slots.offset;
+        const std::uint64_t oldBytes = slotRegionBytes(slotRegion().capacity);
+        publish(header().slots, Layout::Ref<Layout::SlotRegion>{region.offset});
+        release(old, oldBytes);
+        rebuildIndex(bucketsFor(order.size()));
+    }
+
+    void compactIfNeeded() {
+        const std::uint64_t count = slotCount();
+        if ((count - header().liveCount) * 4 <= count) {
+            return;
+        }
+        std::vector<std::size_t> order;
+        order.reserve(header().liveCount);
+        forEachLive([&order](std::size_t slot) {
+            order.push_back(slot);
+            return true;
+        });
+        rewrite(order);
+    }
+
+    void tombstone(std::size_t slot) {
+        Slot& dead = slots()[slot];
+        publish(dead.live, std::uint8_t{0});
+        --header().liveCount;
+        header().nameGarbage += dead.nameLength;
+    }
+
+    void format() {
+        auto& fresh = *new (base) Layout::Header{};
+        fresh.version = Layout::Version;
+        fresh.allocated = HeaderBytes;
+        Allocation region = allocate(slotRegionBytes(InitialSlots));
+        new (base + region.offset) Layout::SlotRegion{slotsFitting(region.bytes), 0};
+        header().slots = {region.offset};
+        region = allocate(indexRegionBytes(InitialSlots));
+        new (base + region.offset) Layout::IndexRegion{InitialSlots};
+        std::fill_n(reinterpret_cast<std::uint32_t*>(base + region.offset + sizeof(Layout::IndexRegion)),
+                    InitialSlots, Layout::NoSlot);
+        header().index = {region.offset};
+        region = allocate(sizeof(Layout::ArenaRegion) + InitialArena);
+        new (base + region.offset) Layout::ArenaRegion{region.bytes - sizeof(Layout::ArenaRegion), 0};
+        header().arena = {region.offset};
+        publish(header().magic, Layout::Magic);
+    }
+
+    template <typename T>
+    [[nodiscard]] bool inside(Layout::Ref<T> ref, std::uint64_t bytes) const {
+        return ref.offset >= HeaderBytes && ref.offset <= header().allocated &&
+               bytes <= header().allocated - ref.offset;
+    }
+
+    // Runs after an unclean shutdown: drops slots that do not point at valid data, then rebuilds the
+    // derived state.
+    void recover() {
+        Layout::Header& h = header();
+        h.allocated = std::min<std::uint64_t>(h.allocated, mappedBytes);
+        bool damaged = !inside(h.slots, sizeof(Layout::SlotRegion)) ||
+                       !inside(h.index, sizeof(Layout::IndexRegion)) || !inside(h.arena, sizeof(Layout::ArenaRegion));
+        if (!damaged) {
+            // Sizes are checked against the file before they are multiplied, so they cannot wrap.
+            const Layout::SlotRegion& region = slotRegion();
+            const std::uint64_t buckets = h.index.in(base)->buckets;
+            const Layout::ArenaRegion& arena = *h.arena.in(base);
+            damaged = region.capacity > h.allocated / sizeof(Slot) ||
+                      !inside(h.slots, slotRegionBytes(region.capacity)) || region.count > region.capacity ||
+                      !std::has_single_bit(buckets) || buckets > h.allocated / sizeof(std::uint32_t) ||
+                      !inside(h.index, indexRegionBytes(buckets)) || arena.capacity > h.allocated ||
+                      arena.used > arena.capacity || !inside(h.arena, sizeof(Layout::ArenaRegion) + arena.capacity);
+        }
+        if (damaged) {
+            throw std::runtime_error(path + " is damaged beyond recovery; restore it from a snapshot");
+        }
+        // A crash may have interrupted a free-list update; leaking those regions until the next vacuum
+        // is safer than trusting the lists.
+        h.freeRegions.fill({});
+        h.freeBytes = 0;
+        std::uint64_t live = 0, dropped = 0;
+        Slot* all = slots();
+        for (std::uint64_t i = 0; i < slotCount(); ++i) {
+            if (!all[i].live) {
+                continue;
+            }
+            if (static_cast<std::size_t>(all[i].kind) >= AnimalKindCount || !inside(all[i].name, all[i].nameLength)) {
+                all[i].live = 0;
+                ++dropped;
+            } else {
+                ++live;
+            }
+        }
+        h.liveCount = live;
+        rebuildIndex(bucketsFor(live));
+        DiagnosticLine() << "Recovered " << path << " after an unclean shutdown: " << live << " animals kept, "
+                         << dropped << " damaged slots dropped";
+        checkpoint();
+    }
+
+    void open() {
+#if defined(__linux__)
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open " + path + ": " + std::strerror(errno));
+        }
+        struct stat status{};
+        if (flock(fd, LOCK_EX | LOCK_NB) != 0 || fstat(fd, &status) != 0) {
+            const std::string reason = errno == EWOULDBLOCK ? "in use by another process" : std::strerror(errno);
+            close(fd);
+            throw std::runtime_error("Cannot open " + path + ": " + reason);
+        }
+        const bool fresh = status.st_size == 0;
+        mappedBytes = fresh ? InitialBytes : static_cast<std::size_t>(status.st_size);
+        void* mapped = fresh && ftruncate(fd, static_cast<off_t>(mappedBytes)) != 0
+                           ? MAP_FAILED
+                           : mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("Cannot map " + path + ": " + std::strerror(errno));
+        }
+        base = static_cast<std::byte*>(mapped);
+        if (fresh) {
+            format();
+            checkpoint();
+        } else if (mappedBytes < HeaderBytes || header().magic != Layout::Magic ||
+                   header().version != Layout::Version) {
+            munmap(base, mappedBytes);
+            close(fd);
+            throw std::runtime_error(path + " is not a mapped animal container");
+        }
+#else
+        throw std::runtime_error("Mapped containers need Linux");
+#endif
+    }
+
+    void unmap() {
+#if defined(__linux__)
+        if (base != nullptr) {
+            munmap(base, mappedBytes);
+            close(fd);
+            base = nullptr;
+        }
+#endif
+    }
+
+    // Makes a rename in the file's directory durable.
+    static void syncDirectoryOf(const std::string& file) {
+#if defined(__linux__)
+        const auto slash = file.rfind('/');
+        const std::string directory = slash == std::string::npos ? "." : slash == 0 ? "/" : file.substr(0, slash);
+        const int dirFd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        const bool synced = dirFd >= 0 && fsync(dirFd) == 0;
+        const int error = errno;
+        if (dirFd >= 0) {
+            close(dirFd);
+        }
+        if (!synced) {
+            throw std::runtime_error("Cannot sync the directory of " + file + ": " + std::strerror(error));
+        }
+#else
+        (void)file;
+#endif
+    }
+
+    // Copies the live animals into a fresh file and renames it over this one. The rename is atomic
+    // and the directory is synced after it, so a crash leaves either the old file or the compacted one.
+    void vacuum() {
+        const std::string compacted = path + ".vacuum";
+        std::remove(compacted.c_str());
+        MappedAnimalContainer fresh(compacted);
+        fresh.reserveSlots(header().liveCount);
+        forEachLive([&](std::size_t slot) {
+            fresh.append(slots()[slot].kind, nameOf(slots()[slot]));
+            return true;
+        });
+        fresh.checkpoint();
+        if (std::rename(compacted.c_str(), path.c_str()) != 0) {
+            throw std::runtime_error("Cannot replace " + path + ": " + std::strerror(errno));
+        }
+        std::swap(fd, fresh.fd);
+        std::swap(base, fresh.base);
+        std::swap(mappedBytes, fresh.mappedBytes);
+        // The replaced file is already unlinked; drop it without a final checkpoint.
+        fresh.unmap();
+        ++vacuums;
+        syncDirectoryOf(path);
+    }
+
+    void append(AnimalKind kind, std::string_view name) {
+        reserveSlots(slotCount() + 1);
+        const Layout::Ref<const char> stored = appendName(name);
+        if (header().liveCount + 1 > header().index.in(base)->buckets) {
+            rebuildIndex(header().index.in(base)->buckets * 2);
+        }
+        const auto slot = static_cast<std::uint32_t>(slotCount());
+        std::uint32_t& head = heads()[bucketOf(name)];
+        slots()[slot] = Slot{stored, static_cast<std::uint32_t>(name.size()), head, kind, 1};
+        publish(slotRegion().count, std::uint64_t{slot} + 1);
+        publish(head, slot);
+        ++header().liveCount;
+    }
+
+    void write(std::string out) const {
+        if (!out.empty()) {
+            LogSink::instance().write(std::move(out));
+        }
+    }
+
+public:
+    explicit MappedAnimalContainer(std::string file) : path(std::move(file)) {
+        const auto started = std::chrono::steady_clock::now();
+        open();
+        try {
+            if (header().state == Layout::State::Dirty) {
+                recover();
+            }
+        } catch (...) {
+            unmap();
+            throw;
+        }
+        openTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started);
+        ++instanceCount;
+    }
+
+    MappedAnimalContainer(const MappedAnimalContainer&) = delete;
+    MappedAnimalContainer& operator=(const MappedAnimalContainer&) = delete;
+
+    [[nodiscard]] std::size_t size() const {
+        return static_cast<std::size_t>(header().liveCount);
+    }
+
+    void addAnimal(const std::shared_ptr<Animal>& animal) {
+        beginMutation();
+        changes.added(static_cast<std::uint32_t>(header().liveCount), animal);
+        append(animal->getKind(), animal->getName());
+    }
+
+    [[nodiscard]] std::string renderDisplay() const {
+        std::string out;
+        forEachLive([&](std::size_t slot) {
+            appendDisplayRow(out, slots()[slot].kind, nameOf(slots()[slot]));
+            return true;
+        });
+        return out;
+    }
+
+    [[nodiscard]] std::string renderInfo(const std::string& type) const {
+        const auto kind = kindFromType(type);
+        std::string out;
+        if (!kind) {
+            return out;
+        }
+        std::vector<std::string_view> names;
+        forEachLive([&](std::size_t slot) {
+            if (slots()[slot].kind == *kind) {
+                names.push_back(nameOf(slots()[slot]));
+            }
+            return true;
+        });
+        std::vector<std::size_t> ends(names.size());
+        animalKinds[static_cast<std::size_t>(*kind)].infoNames(names, out, ends);
+        return out;
+    }
+
+    void displayAll() const {
+        write(renderDisplay());
+    }
+
+    void displayAnimalInfo(const std::string& type) const {
+        write(renderInfo(type));
+    }
+
+    void removeAnimal(const std::string& type) {
+        const auto kind = kindFromType(type);
+        if (!kind) {
+            return;
+        }
+        beginMutation();
+        std::vector<std::uint32_t> positions;
+        std::uint32_t position = 0;
+        forEachLive([&](std::size_t slot) {
+            if (slots()[slot].kind == *kind) {
+                positions.push_back(position);
+                tombstone(slot);
+            }
+            ++position;
+            return true;
+        });
+        changes.removed(std::move(positions));
+        compactIfNeeded();
+    }
+
+    std::size_t removeAnimalByName(std::string_view name) {
+        std::vector<std::size_t> matches;
+        forEachNamed(name, [&matches](std::size_t slot) {
+            matches.push_back(slot);
+            return true;
+        });
+        if (matches.empty()) {
+            return 0;
+        }
+        beginMutation();
+        if (changes.enabled()) {
+            std::ranges::sort(matches);
+            std::vector<std::uint32_t> positions;
+            std::uint32_t position = 0;
+            auto next = matches.begin();
+            forEachLive([&](std::size_t slot) {
+                if (slot == *next) {
+                    positions.push_back(position);
+                    ++next;
+                }
+                ++position;
+                return next != matches.end();
+            });
+            changes.removed(std::move(positions));
+        }
+        for (std::size_t slot : matches) {
+            tombstone(slot);
+        }
+        compactIfNeeded();
+        return matches.size();
+    }
+
+    [[nodiscard]] std::shared_ptr<Animal> findAnimal(std::string_view name) const {
+        std::size_t first = Layout::NoSlot;
+        forEachNamed(name, [&first](std::size_t slot) {
+            first = std::min(first, slot);
+            return true;
+        });
+        if (first == Layout::NoSlot) {
+            return nullptr;
+        }
+        return animalKinds[static_cast<std::size_t>(slots()[first].kind)].create(std::string(name));
+    }
+
+    [[nodiscard]] std::vector<std::shared_ptr<Animal>> lookupMany(std::span<const std::string_view> names) const {
+        std::vector<std::shared_ptr<Animal>> found;
+        found.reserve(names.size());
+        for (std::string_view name : names) {
+            found.push_back(findAnimal(name));
+        }
+        return found;
+    }
+
+    [[nodiscard]] AnimalQuery<MappedAnimalContainer> query() const {
+        return AnimalQuery<MappedAnimalContainer>(*this);
+    }
+
+    // A name-equality predicate walks that name's index chain; everything else scans the slots.
+    template <typename Emit>
+    void executeQuery(const QuerySpec& spec, Emit emit) const {
+        const auto kindAt = [this](std::size_t slot) { return slots()[slot].kind; };
+        const auto nameAt = [this](std::size_t slot) { return nameOf(slots()[slot]); };
+        if (!spec.nameEquals.empty()) {
+            finishQuery(spec, [&](auto visit) { forEachNamed(spec.nameEquals.front(), visit); }, kindAt, nameAt,
+                        emit);
+        } else {
+            finishQuery(spec, [this](auto visit) { forEachLive(visit); }, kindAt, nameAt, emit);
+        }
+    }
+
+    [[nodiscard]] std::string renderQuery(const QuerySpec& spec) const {
+        std::string out;
+        executeQuery(spec, [&out](AnimalKind kind, std::string_view name) { appendDisplayRow(out, kind, name); });
+        return out;
+    }
+
+    void sortAnimals() {
+        beginMutation();
+        std::vector<std::size_t> live;
+        live.reserve(header().liveCount);
+        forEachLive([&live](std::size_t slot) {
+            live.push_back(slot);
+            return true;
+        });
+        std::vector<std::size_t> positions(live.size());
+        for (std::size_t i = 0; i < positions.size(); ++i) {
+            positions[i] = i;
+        }
+        const std::vector<std::size_t> order = sortOrderByTypeAndName(
+            positions, [&](std::size_t position) { return slots()[live[position]].kind; },
+            [&](std::size_t position) { return nameOf(slots()[live[position]]); });
+        changes.reordered(order);
+        for (std::size_t& position : positions) {
+            position = live[order[position]];
+        }
+        rewrite(positions);
+    }
+
+    void trackChanges(bool on) {
+        changes.track(on);
+    }
+
+    [[nodiscard]] std::vector<AnimalChange> takeChanges() {
+        return changes.take();
+    }
+
+    // Flushes every dirty page of the file, then marks it Clean.
+    void checkpoint() {
+#if defined(__linux__)
+        const auto started = std::chrono::steady_clock::now();
+        if (msync(base, mappedBytes, MS_SYNC) != 0) {
+            throw std::runtime_error("Cannot sync " + path + ": " + std::strerror(errno));
+        }
+        header().state = Layout::State::Clean;
+        ++header().checkpoints;
+        msync(base, HeaderBytes, MS_SYNC);
+        lastCheckpoint =
+            std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started);
+#endif
+    }
+
+    // Vacuums once less than half the allocated file is in use, counting removed names, free regions
+    // and whatever recovery leaked as unused. The copy is not sliced, so the budget is ignored; it
+    // only runs after enough churn to pay for itself.
+    bool compactFor(std::chrono::microseconds) {
+        const Layout::Header& h = header();
+        const std::uint64_t inUse = HeaderBytes + slotRegionBytes(slotRegion().capacity) +
+                                    indexRegionBytes(h.index.in(base)->buckets) + h.nameBytes - h.nameGarbage;
+        if (h.allocated > 4 * InitialBytes && inUse * 2 < h.allocated) {
+            vacuum();
+        }
+        return false;
+    }
+
+    void reportMetrics() const {
+        const Layout::Header& h = header();
+        LogLine() << "Mapped storage " << path << ": " << h.liveCount << " animals in " << slotCount() << " of "
+                  << slotRegion().capacity << " slots, " << h.index.in(base)->buckets << " index buckets";
+        LogLine() << "  file: " << mappedBytes << " bytes mapped, " << h.allocated << " allocated, " << h.freeBytes
+                  << " in free regions, " << h.nameGarbage << " of " << h.nameBytes << " name bytes removed; "
+                  << remaps << " remaps, " << vacuums << " vacuums";
+        LogLine() << "  " << (h.state == Layout::State::Clean ? "clean" : "dirty") << ", " << h.checkpoints
+                  << " checkpoints (last " << lastCheckpoint.count() << " us), opened in " << openTime.count()
+                  << " us";
+    }
+
+    ~MappedAnimalContainer() {
+        if (base != nullptr) {
+            try {
+                checkpoint();
+            } catch (const std::runtime_error& e) {
+                std::cerr << e.what() << std::endl;
+            }
+        }
+        unmap();
+        --instanceCount;
+    }
+};
+
+class AnimalFactory {
+public:
+    static std::shared_ptr<Animal> createAnimal(const std::string& type, const std::string& name) {
+        if (type == "Dog") {
+            return makeAnimal<Dog>(name);
+        } else if (type == "Cat") {
+            return makeAnimal<Cat>(name);
+        } else {
+            throw std::invalid_argument("Unknown animal type");
+        }
+    }
+};
+
+// CRC32C (Castagnoli). Uses the SSE4.2 crc32 instruction when the CPU has it, a table otherwise;
+// crc32c(b, crc32c(a)) == crc32c(a + b).
+class Crc32c {
+private:
+    static const std::array<std::uint32_t, 256>& table() {
+        static const auto entries = [] {
+            std::array<std::uint32_t, 256> built{};
+            for (std::uint32_t i = 0; i < 256; ++i) {
+                std::uint32_t crc = i;
+                for (int bit = 0; bit < 8; ++bit) {
+                    crc = (crc >> 1) ^ (0x82f63b78u & (0u - (crc & 1u)));
+                }
+                built[i] = crc;
+            }
+            return built;
+        }();
+        return entries;
+    }
+
+    static std::uint32_t software(std::uint32_t crc, std::string_view data) {
+        const auto& entries = table();
+        for (unsigned char byte : data) {
+            crc = entries[(crc ^ byte) & 0xffu] ^ (crc >> 8);
+        }
+        return crc;
+    }
+
+#if defined(__x86_64__)
+    __attribute__((target("sse4.2"))) static std::uint32_t hardware(std::uint32_t crc, std::string_view data) {
+        std::uint64_t wide = crc;
+        std::size_t i = 0;
+        for (; i + 8 <= data.size(); i += 8) {
+            std::uint64_t word;
+            std::memcpy(&word, data.data() + i, sizeof(word));
+            wide = _mm_crc32_u64(wide, word);
+        }
+        crc = static_cast<std::uint32_t>(wide);
+        for (; i < data.size(); ++i) {
+            crc = _mm_crc32_u8(crc, static_cast<unsigned char>(data[i]));
+        }
+        return crc;
+    }
+#endif
+
+public:
+    [[nodiscard]] static bool accelerated() {
+#if defined(__x86_64__)
+        static const bool supported = __builtin_cpu_supports("sse4.2");
+        return supported;
+#else
+        return false;
+#endif
+    }
+
+    [[nodiscard]] static std::uint32_t compute(std::string_view data, std::uint32_t crc = 0) {
+#if defined(__x86_64__)
+        if (accelerated()) {
+            return ~hardware(~crc, data);
+        }
+#endif
+        return ~software(~crc, data);
+    }
+};
+
+// On-disk snapshot chain. The base image at <path> holds every slot page; each delta <path>.1,
+// <path>.2, ... holds only the pages dirtied since the file before it. Files name their chain and
+// sequence number, so deltas left behind by an older chain are ignored. Each page record carries a
+// CRC32C over its header and payload, and a payload is one record per live animal in display order
+// (kind byte, 32-bit name length, name bytes).
+struct SnapshotFormat {
+    static constexpr std::string_view Magic = "ANIMSNAP";
+    static constexpr std::uint32_t Version = 2;
+
+    struct Header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t sequence;
+        std::uint64_t chain;
+        // Pages in the container when the file was written; pages past it are dropped on load.
+        std::uint64_t pageCount;
+        std::uint64_t pagesWritten;
+    };
+
+    struct PageHeader {
+        std::uint64_t page;
+        std::uint32_t animals;
+        std::uint32_t bytes;
+        std::uint32_t checksum;
+        std::uint32_t reserved;
+    };
+
+    static_assert(std::is_trivially_copyable_v<Header> && std::is_trivially_copyable_v<PageHeader>);
+
+    [[nodiscard]] static std::string filePath(const std::string& base, std::uint32_t sequence) {
+        return sequence == 0 ? base : base + "." + std::to_string(sequence);
+    }
+
+    // Hands one record's bytes to sink in pieces, so a writer can size, checksum or copy it in place.
+    template <typename Sink>
+    static void putRecord(AnimalKind kind, std::string_view name, Sink sink) {
+        const char tag = static_cast<char>(kind);
+        const auto length = static_cast<std::uint32_t>(name.size());
+        sink(std::string_view(&tag, 1));
+        sink(std::string_view(reinterpret_cast<const char*>(&length), sizeof(length)));
+        sink(name);
+    }
+
+    [[nodiscard]] static std::uint32_t checksum(PageHeader header, std::string_view payload) {
+        header.checksum = 0;
+        const std::uint32_t crc =
+            Crc32c::compute(std::string_view(reinterpret_cast<const char*>(&header), sizeof(header)));
+        return Crc32c::compute(payload, crc);
+    }
+};
+
+struct SnapshotChainStats {
+    std::size_t files = 0;
+    std::size_t pages = 0;
+    std::size_t animals = 0;
+    std::uint64_t bytes = 0;
+};
+
+// Reads a base image and its deltas. Every page checksum and record is validated before the first
+// animal is emitted, so a damaged chain throws without leaving a partial load behind.
+template <typename Emit>
+SnapshotChainStats loadSnapshotChain(const std::string& path, Emit emit) {
+    using Format = SnapshotFormat;
+    SnapshotChainStats stats;
+    // A deque, so the page views below stay valid while later files are appended.
+    std::deque<std::string> files;
+    std::vector<std::string_view> pages;
+    std::uint64_t chain = 0;
+    for (std::uint32_t sequence = 0;; ++sequence) {
+        const std::string file = Format::filePath(path, sequence);
+        std::FILE* in = std::fopen(file.c_str(), "rb");
+        if (in == nullptr) {
+            if (sequence == 0) {
+                throw std::runtime_error("Cannot open snapshot " + file + ": " + std::strerror(errno));
+            }
+            break;
+        }
+        std::string data;
+        char chunk[1 << 16];
+        for (std::size_t got; (got = std::fread(chunk, 1, sizeof(chunk), in)) != 0;) {
+            data.append(chunk, got);
+        }
+        std::fclose(in);
+        Format::Header header;
+        if (data.size() < sizeof(header)) {
+            throw std::runtime_error("Snapshot " + file + " is truncated");
+        }
+        std::memcpy(&header, data.data(), sizeof(header));
+        if (std::string_view(header.magic, sizeof(header.magic)) != Format::Magic ||
+            header.version != Format::Version) {
+            throw std::runtime_error("Snapshot " + file + " has an unknown format");
+        }
+        if (sequence == 0) {
+            chain = header.chain;
+        } else if (header.chain != chain || header.sequence != sequence) {
+            break;
+        }
+        // The header is not checksummed, so its counts are checked against the file: every written
+        // page takes at least a page header, and pages past the previous count are new, so dirty.
+        const std::uint64_t known = sequence == 0 ? 0 : pages.size();
+        if (header.pagesWritten > (data.size() - sizeof(header)) / sizeof(Format::PageHeader) ||
+            header.pageCount > known + header.pagesWritten) {
+            throw std::runtime_error("Snapshot " + file + " has a malformed header");
+        }
+        files.push_back(std::move(data));
+        const std::string& image = files.back();
+        pages.resize(header.pageCount);
+        std::size_t offset = sizeof(header);
+        for (std::uint64_t i = 0; i < header.pagesWritten; ++i) {
+            Format::PageHeader page;
+            if (image.size() - offset < sizeof(page)) {
+                throw std::runtime_error("Snapshot " + file + " is truncated");
+            }
+            std::memcpy(&page, image.data() + offset, sizeof(page));
+            offset += sizeof(page);
+            if (image.size() - offset < page.bytes || page.page >= header.pageCount) {
+                throw std::runtime_error("Snapshot " + file + " has a malformed page");
+            }
+            const std::string_view payload(image.data() + offset, page.bytes);
+            if (Format::checksum(page, payload) != page.checksum) {
+                throw std::runtime_error("Snapshot " + file + " page " + std::to_string(page.page) +
+                                         " failed its checksum");
+            }
+            pages[page.page] = payload;
+            offset += page.bytes;
+            ++stats.pages;
+        }
+        stats.bytes += image.size();
+        ++stats.files;
+    }
+    std::vector<std::pair<AnimalKind, std::string_view>> animals;
+    for (std::string_view payload : pages) {
+        while (!payload.empty()) {
+            std::uint32_t length = 0;
+            if (payload.size() < 1 + sizeof(length) || static_cast<std::size_t>(payload[0]) >= AnimalKindCount) {
+                throw std::runtime_error("Snapshot " + path + " has a malformed record");
+            }
+            const auto kind = static_cast<AnimalKind>(payload[0]);
+            std::memcpy(&length, payload.data() + 1, sizeof(length));
+            payload.remove_prefix(1 + sizeof(length));
+            if (payload.size() < length) {
+                throw std::runtime_error("Snapshot " + path + " has a malformed record");
+            }
+            animals.emplace_back(kind, payload.substr(0, length));
+            payload.remove_prefix(length);
+        }
+    }
+    for (const auto& [kind, name] : animals) {
+        emit(kind, name);
+    }
+    stats.animals = animals.size();
+    return stats;
+}
+
+// Redis-style BGSAVE. The container forks while holding its write lock, so the child inherits a
+// quiescent image; the child streams it to disk while the kernel copies only the pages the parent
+// dirties meanwhile. Checkpoints after the first write only the slot pages dirtied since the last
+// one, as deltas chained to the base; once the chain has MaxDeltas files or outweighs its base, the
+// next checkpoint folds it into a fresh base, and a delta that would rewrite every page becomes a
+// base right away. Progress, the file actually written and the child's copy-on-write footprint come
+// back through a small shared anonymous mapping.
+class BackgroundSnapshot {
+private:
+    using Clock = std::chrono::steady_clock;
+    using Format = SnapshotFormat;
+
+    static constexpr std::uint32_t MaxDeltas = 8;
+
+    struct Progress {
+        std::atomic<std::uint64_t> chain{0};
+        std::atomic<std::uint32_t> sequence{0};
+        std::atomic<std::uint64_t> pageCount{0};
+        std::atomic<std::uint64_t> totalPages{0};
+        std::atomic<std::uint64_t> writtenPages{0};
+        std::atomic<std::uint64_t> animals{0};
+        std::atomic<std::uint64_t> bytes{0};
+        std::atomic<std::uint64_t> copyOnWriteBytes{0};
+    };
+
+    struct Checkpoint {
+        std::string path;
+        std::uint64_t chain = 0;
+        std::uint32_t sequence = 0;
+        std::uint64_t pageCount = 0;
+    };
+
+    // Everything the child would otherwise allocate, built before fork(): a child of a threaded
+    // process may only make async-signal-safe calls, and malloc is not one of them.
+    struct ChildScratch {
+        std::string file;
+        std::string temporary;
+        std::string baseFile;
+        std::string baseTemporary;
+        std::array<std::string, MaxDeltas> deltaFiles;
+        std::vector<char> buffer;
+
+        void prepare(const Checkpoint& checkpoint) {
+            file = Format::filePath(checkpoint.path, checkpoint.sequence);
+            temporary = file + ".tmp";
+            baseFile = Format::filePath(checkpoint.path, 0);
+            baseTemporary = baseFile + ".tmp";
+            for (std::uint32_t sequence = 1; sequence <= MaxDeltas; ++sequence) {
+                deltaFiles[sequence - 1] = Format::filePath(checkpoint.path, sequence);
+            }
+            buffer.resize(std::size_t{1} << 20);
+        }
+    };
+
+    Progress* progress = nullptr;
+    Checkpoint pending;
+    Checkpoint current;
+    bool needsBase = true;
+    std::uint64_t baseBytes = 0;
+    std::uint64_t deltaBytes = 0;
+    int child = -1;
+    Clock::time_point started;
+    std::uint64_t residentAtFork = 0;
+    ChildScratch scratch;
+    std::uint64_t bases = 0;
+    std::uint64_t deltas = 0;
+    std::uint64_t failed = 0;
+    std::uint64_t bytesWritten = 0;
+    std::string lastResult;
+
+    // Reads a "Field:  <n> kB" line from a /proc status file. Uses only open/read and a stack
+    // buffer, so the snapshot child can call it.
+    static std::uint64_t procBytes(const char* file, std::string_view field) {
+#if defined(__linux__)
+        char text[8192];
+        std::size_t size = 0;
+        const int fd = open(file, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return 0;
+        }
+        for (ssize_t got; size < sizeof(text) && (got = ::read(fd, text + size, sizeof(text) - size)) > 0;) {
+            size += static_cast<std::size_t>(got);
+        }
+        close(fd);
+        for (std::string_view rest(text, size); !rest.empty();) {
+            const std::size_t end = std::min(rest.find('\n'), rest.size());
+            std::string_view line = rest.substr(0, end);
+            rest.remove_prefix(std::min(end + 1, rest.size()));
+            if (line.starts_with(field)) {
+                line.remove_prefix(field.size());
+                line.remove_prefix(std::min(line.find_first_not_of(' '), line.size()));
+                std::uint64_t kib = 0;
+                std::from_chars(line.data(), line.data() + line.size(), kib);
+                return kib * 1024;
+            }
+        }
+#else
+        (void)file;
+        (void)field;
+#endif
+        return 0;
+    }
+
+    [[nodiscard]] bool wantsBase(const std::string& path) const {
+        return needsBase || path != current.path || current.sequence >= MaxDeltas || deltaBytes >= baseBytes;
+    }
+
+#if defined(__linux__)
+    static bool writeAll(int fd, std::string_view data) {
+        while (!data.empty()) {
+            const ssize_t written = ::write(fd, data.data(), data.size());
+            if (written <= 0) {
+                return false;
+            }
+            data.remove_prefix(static_cast<std::size_t>(written));
+        }
+        return true;
+    }
+
+    // Runs in the child: no other threads exist there, so it must not touch the log sink, and it
+    // must not allocate, so it writes through the scratch the parent prepared. Without a payload
+    // buffer each page is scanned three times: to size it, to checksum it and to write it.
+    template <typename ScanPage>
+    static bool writeImage(const Checkpoint& checkpoint, const std::vector<bool>& dirty, ScanPage scanPage,
+                           Progress& progress, ChildScratch& scratch) {
+        Format::Header header{};
+        std::copy(Format::Magic.begin(), Format::Magic.end(), header.magic);
+        header.version = Format::Version;
+        header.sequence = checkpoint.sequence;
+        header.chain = checkpoint.chain;
+        header.pageCount = checkpoint.pageCount;
+        header.pagesWritten = static_cast<std::uint64_t>(std::ranges::count(dirty, true));
+        progress.totalPages.store(header.pagesWritten);
+        const bool base = checkpoint.sequence == 0;
+        const std::string& file = base ? scratch.baseFile : scratch.file;
+        const std::string& temporary = base ? scratch.baseTemporary : scratch.temporary;
+        const int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        std::span<char> buffer(scratch.buffer);
+        std::size_t used = 0;
+        bool ok = true;
+        const auto flush = [&] {
+            ok = ok && writeAll(fd, std::string_view(buffer.data(), used));
+            progress.bytes.fetch_add(used);
+            used = 0;
+        };
+        const auto put = [&](std::string_view data) {
+            while (!data.empty()) {
+                if (used == buffer.size()) {
+                    flush();
+                }
+                const std::size_t take = std::min(data.size(), buffer.size() - used);
+                std::memcpy(buffer.data() + used, data.data(), take);
+                used += take;
+                data.remove_prefix(take);
+            }
+        };
+        put(std::string_view(reinterpret_cast<const char*>(&header), sizeof(header)));
+        for (std::size_t page = 0; page < dirty.size() && ok; ++page) {
+            if (!dirty[page]) {
+                continue;
+            }
+            Format::PageHeader record{page, 0, 0, 0, 0};
+            scanPage(page, [&](AnimalKind kind, std::string_view name) {
+                Format::putRecord(kind, name, [&](std::string_view piece) {
+                    record.bytes += static_cast<std::uint32_t>(piece.size());
+                });
+                ++record.animals;
+            });
+            std::uint32_t crc = Format::checksum(record, {});
+            scanPage(page, [&](AnimalKind kind, std::string_view name) {
+                Format::putRecord(kind, name, [&](std::string_view piece) { crc = Crc32c::compute(piece, crc); });
+            });
+            record.checksum = crc;
+            put(std::string_view(reinterpret_cast<const char*>(&record), sizeof(record)));
+            scanPage(page, [&](AnimalKind kind, std::string_view name) { Format::putRecord(kind, name, put); });
+            progress.animals.fetch_add(record.animals);
+            progress.writtenPages.fetch_add(1);
+        }
+        flush();
+        ok = ok && fsync(fd) == 0;
+        close(fd);
+        if (!ok || std::rename(temporary.c_str(), file.c_str()) != 0) {
+            unlink(temporary.c_str());
+            return false;
+        }
+        // A new base orphans the old chain's deltas; they would be ignored on load, but take space.
+        if (base) {
+            for (const std::string& delta : scratch.deltaFiles) {
+                if (unlink(delta.c_str()) != 0) {
+                    break;
+                }
+            }
+        }
+        return true;
+    }
+#endif
+
+public:
+    BackgroundSnapshot() {
+#if defined(__linux__)
+        void* shared = mmap(nullptr, sizeof(Progress), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (shared != MAP_FAILED) {
+            progress = new (shared) Progress();
+        }
+#endif
+    }
+
+    BackgroundSnapshot(const BackgroundSnapshot&) = delete;
+    BackgroundSnapshot& operator=(const BackgroundSnapshot&) = delete;
+
+    [[nodiscard]] bool running() const {
+        return child > 0;
+    }
+
+    template <typename Container>
+    bool start(Container& container, std::string path) {
+        if (running()) {
+            LogLine() << "A background snapshot is already running";
+            return false;
+        }
+#if defined(__linux__)
+        if (progress == nullptr) {
+            return false;
+        }
+        progress->~Progress();
+        new (progress) Progress();
+        const bool full = wantsBase(path);
+        std::random_device entropy;
+        const std::uint64_t freshChain = (std::uint64_t{entropy()} << 32) | entropy();
+        if (full) {
+            pending = {std::move(path), freshChain, 0, 0};
+        } else {
+            pending = {std::move(path), current.chain, current.sequence + 1, 0};
+        }
+        residentAtFork = procBytes("/proc/self/status", "VmRSS:");
+        scratch.prepare(pending);
+        // Builds the checksum table here, so the child does not run its first-use initialisation.
+        (void)Crc32c::compute({});
+        started = Clock::now();
+        Progress& shared = *progress;
+        ChildScratch& childScratch = scratch;
+        Checkpoint checkpoint = pending;
+        child = container.forkSnapshot(full, [&](std::size_t pageCount, const std::vector<bool>& dirty,
+                                                 auto scanPage) {
+            if (checkpoint.sequence != 0 && std::ranges::find(dirty, false) == dirty.end()) {
+                checkpoint.chain = freshChain;
+                checkpoint.sequence = 0;
+            }
+            checkpoint.pageCount = pageCount;
+            shared.chain.store(checkpoint.chain);
+            shared.sequence.store(checkpoint.sequence);
+            shared.pageCount.store(pageCount);
+            const bool ok = writeImage(checkpoint, dirty, scanPage, shared, childScratch);
+            shared.copyOnWriteBytes.store(procBytes("/proc/self/smaps_rollup", "Private_Dirty:"));
+            _exit(ok ? 0 : 1);
+        });
+        if (child < 0) {
+            LogLine() << "Cannot fork snapshot child: " << std::strerror(errno);
+            return false;
+        }
+        LogLine() << "Background snapshot to " << pending.path << " started in child " << child;
+        return true;
+#else
+        (void)container;
+        (void)path;
+        LogLine() << "Background snapshots need Linux";
+        return false;
+#endif
+    }
+
+    // Resolves once the child in flight, if any, has been reaped, checking back on a scheduler timer
+    // instead of blocking a thread in waitpid.
+    Task<void> completion() {
+        while (running()) {
+            poll();
+            if (running()) {
+                co_await CoroutineScheduler::instance().sleepFor(std::chrono::milliseconds(5));
+            }
+        }
+    }
+
+    // Reaps the child once it exits; call regularly from the owning loop.
+    void poll(bool wait = false) {
+#if defined(__linux__)
+        int status = 0;
+        if (!running() || waitpid(child, &status, wait ? 0 : WNOHANG) != child) {
+            return;
+        }
+        child = -1;
+        const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - started);
+        const std::uint64_t bytes = progress->bytes.load();
+        pending.chain = progress->chain.load();
+        pending.sequence = progress->sequence.load();
+        pending.pageCount = progress->pageCount.load();
+        std::ostringstream result;
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+            if (pending.sequence == 0) {
+                ++bases;
+                baseBytes = bytes;
+                deltaBytes = 0;
+            } else {
+                ++deltas;
+                deltaBytes += bytes;
+            }
+            bytesWritten += bytes;
+            current = pending;
+            needsBase = false;
+            result << "saved " << progress->writtenPages.load() << " of " << pending.pageCount << " pages ("
+                   << progress->animals.load() << " animals, " << bytes << " bytes) to "
+                   << Format::filePath(pending.path, pending.sequence) << " in " << elapsed.count()
+                   << " ms, copy-on-write " << progress->copyOnWriteBytes.load() / 1024 << " KiB";
+        } else {
+            // The container already forgot which pages this delta covered.
+            ++failed;
+            needsBase = true;
+            result << "failed writing " << Format::filePath(pending.path, pending.sequence) << " after "
+                   << elapsed.count() << " ms";
+        }
+        lastResult = result.str();
+        DiagnosticLine() << "Background snapshot " << lastResult;
+#else
+        (void)wait;
+#endif
+    }
+
+    void reportMetrics() const {
+        if (running()) {
+            const std::uint64_t total = progress->totalPages.load();
+            const std::uint64_t written = progress->writtenPages.load();
+            LogLine() << "Background snapshot to " << pending.path << ": " << written << " of " << total
+                      << " pages (" << (total == 0 ? 0 : written * 100 / total) << "%), " << progress->bytes.load()
+                      << " bytes, "
+                      << std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - started).count()
+                      << " ms; copy-on-write overhead at most " << residentAtFork / 1024 << " KiB (RSS at fork)";
+        }
+        LogLine() << "Snapshots: " << bases << " base, " << deltas << " delta, " << failed << " failed, "
+                  << bytesWritten << " bytes written; chain " << current.sequence << " deltas (" << deltaBytes
+                  << " bytes) on a " << baseBytes << " byte base; CRC32C "
+                  << (Crc32c::accelerated() ? "hardware" : "software") << (lastResult.empty() ? "" : "; last ")
+                  << lastResult;
+    }
+
+    ~BackgroundSnapshot() {
+        poll(true);
+#if defined(__linux__)
+        if (progress != nullptr) {
+            munmap(progress, sizeof(Progress));
+        }
+#endif
+    }
+};
+
+// Command trace: a Header, then one Record per menu command, each followed by the command's arguments
+// as u32-length strings exactly as answered at its prompts. offsetMicros is when the option was chosen,
+// counted from the start of the recording, so a replay can keep the original pacing.
+struct CommandTraceFormat {
+    static constexpr std::string_view Magic = "ANIMTRCE";
+    // Records hold menu option numbers, so the version changes whenever the menu is renumbered.
+    static constexpr std::uint32_t Version = 1;
+
+    struct Header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t reserved;
+    };
+
+    struct Record {
+        std::uint32_t length;
+        std::int32_t choice;
+        std::uint64_t offsetMicros;
+    };
+
+    static_assert(std::is_trivially_copyable_v<Header> && std::is_trivially_copyable_v<Record>);
+};
+
+struct TracedCommand {
+    int choice = 0;
+    std::chrono::microseconds offset{0};
+    std::vector<std::string> arguments;
+};
+
+// Appends commands to a trace file. Each record is flushed as it is written, so a trace taken up to
+// a crash or a kill still replays everything that ran; a write error stops the recording, not the menu.
+class CommandRecorder {
+private:
+    std::FILE* out = nullptr;
+    std::string path;
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    std::size_t recorded = 0;
+
+public:
+    explicit CommandRecorder(const std::string& file) : path(file) {
+        out = std::fopen(path.c_str(), "wb");
+        if (out == nullptr) {
+            throw std::runtime_error("Cannot open trace " + path + ": " + std::strerror(errno));
+        }
+        CommandTraceFormat::Header header{};
+        std::memcpy(header.magic, CommandTraceFormat::Magic.data(), sizeof(header.magic));
+        header.version = CommandTraceFormat::Version;
+        if (std::fwrite(&header, sizeof(header), 1, out) != 1 || std::fflush(out) != 0) {
+            std::fclose(out);
+            throw std::runtime_error("Cannot write trace " + path + ": " + std::strerror(errno));
+        }
+    }
+
+    CommandRecorder(const CommandRecorder&) = delete;
+    CommandRecorder& operator=(const CommandRecorder&) = delete;
+
+    [[nodiscard]] std::chrono::microseconds elapsed() const {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started);
+    }
+
+    void record(int choice, std::chrono::microseconds offset, std::span<const std::string> arguments) {
+        if (out == nullptr) {
+            return;
+        }
+        WireEncoder<CommandTraceFormat::Record> record;
+        for (const std::string& argument : arguments) {
+            record.putName(argument);
+        }
+        const std::string bytes = std::move(record).finish(
+            {0, static_cast<std::int32_t>(choice), static_cast<std::uint64_t>(offset.count())});
+        if (std::fwrite(bytes.data(), 1, bytes.size(), out) != bytes.size() || std::fflush(out) != 0) {
+            DiagnosticLine() << "Trace " << path << " stopped after " << recorded
+                             << " commands: " << std::strerror(errno);
+            std::fclose(out);
+            out = nullptr;
+            return;
+        }
+        ++recorded;
+    }
+
+    ~CommandRecorder() {
+        if (out != nullptr) {
+            std::fclose(out);
+        }
+    }
+};
+
+// Reads a whole trace. A torn final record, left by a recorder that died mid-write, is dropped;
+// anything else out of shape throws.
+inline std::vector<TracedCommand> loadCommandTrace(const std::string& path) {
+    using Format = CommandTraceFormat;
+    std::FILE* in = std::fopen(path.c_str(), "rb");
+    if (in == nullptr) {
+        throw std::runtime_error("Cannot open trace " + path + ": " + std::strerror(errno));
+    }
+    std::string data;
+    char chunk[1 << 16];
+    for (std::size_t got; (got = std::fread(chunk, 1, sizeof(chunk), in)) != 0;) {
+        data.append(chunk, got);
+    }
+    std::fclose(in);
+    Format::Header header;
+    if (data.size() < sizeof(header)) {
+        throw std::runtime_error("Trace " + path + " is truncated");
+    }
+    std::memcpy(&header, data.data(), sizeof(header));
+    if (std::string_view(header.magic, sizeof(header.magic)) != Format::Magic || header.version != Format::Version) {
+        throw std::runtime_error("Trace " + path + " has an unknown format");
+    }
+    std::vector<TracedCommand> commands;
+    std::string_view rest = std::string_view(data).substr(sizeof(header));
+    bool torn = false;
+    while (!rest.empty()) {
+        Format::Record record;
+        if (rest.size() < sizeof(record)) {
+            torn = true;
+            break;
+        }
+        std::memcpy(&record, rest.data(), sizeof(record));
+        if (rest.size() - sizeof(record) < record.length) {
+            torn = true;
+            break;
+        }
+        rest.remove_prefix(sizeof(record));
+        TracedCommand& command = commands.emplace_back();
+        command.choice = record.choice;
+        command.offset = std::chrono::microseconds(record.offsetMicros);
+        try {
+            for (WireDecoder arguments(rest.substr(0, record.length)); !arguments.done();) {
+                command.arguments.emplace_back(arguments.getName());
+            }
+        } catch (const std::runtime_error&) {
+            throw std::runtime_error("Trace " + path + " has a malformed record");
+        }
+        rest.remove_prefix(record.length);
+    }
+    if (torn) {
+        DiagnosticLine() << "Trace " << path << " ends in a torn record; replaying the " << commands.size()
+                         << " complete ones";
+    }
+    return commands;
+}
+
+// Menu option labels, indexed by option number.
+constexpr std::array<std::string_view, 15> menuOptions = {"",
+                                                          "Add Animal",
+                                                          "Display All Animals",
+                                                          "Remove Animal",
+                                                          "Display Animal Info",
+                                                          "Sort Animals",
+                                                          "Show AnimalContainer Instance Count",
+                                                          "Exit",
+                                                          "Find Animal by Name",
+                                                          "Show Metrics",
+                                                          "Query Animals",
+                                                          "Add Partition Worker",
+                                                          "Save Snapshot in Background",
+                                                          "Checkpoint Mapped File",
+                                                          "Remove Animals by Name"};
+
+[[nodiscard]] std::string_view menuOption(int choice) {
+    if (choice < 1 || static_cast<std::size_t>(choice) >= menuOptions.size()) {
+        return "Invalid option";
+    }
+    return menuOptions[static_cast<std::size_t>(choice)];
+}
+
+void menu(bool partitioned = false, bool snapshots = false, bool checkpoints = false) {
+    std::string text;
+    for (int choice = 1; choice < static_cast<int>(menuOptions.size()); ++choice) {
+        if ((choice == 11 && !partitioned) || (choice == 12 && !snapshots) || (choice == 13 && !checkpoints)) {
+            continue;
+        }
+        text += std::to_string(choice) + ". " + std::string(menuOption(choice)) + "\n";
+    }
+    LogSink::instance().write(std::move(text));
+    LogSink::instance().flush();
+}
+
+void showMetrics() {
+    StorageMemory::reportMetrics();
+    AnimalBlockPool::reportMetrics();
+    CoroutineScheduler::instance().reportMetrics();
+    LogLine() << "Log records dropped: " << LogSink::instance().dropped();
+}
+
+void prompt(const std::string& text) {
+    LogSink::instance().write(text);
+    LogSink::instance().flush();
+}
+
+// Answers a command's prompts. Live, it prompts on stdin and keeps what was typed for the trace;
+// replaying, it hands back the recorded answers in order, and a missing one reads as empty.
+class CommandArguments {
+private:
+    bool live = true;
+    std::span<const std::string> replayed;
+    std::vector<std::string> typed;
+
+public:
+    CommandArguments() = default;
+    explicit CommandArguments(std::span<const std::string> recorded) : live(false), replayed(recorded) {}
+
+    template <typename T = std::string>
+    T next(const std::string& text) {
+        T value{};
+        if (live) {
+            prompt(text);
+            std::cin >> value;
+            if constexpr (std::is_same_v<T, std::string>) {
+                typed.push_back(value);
+            } else {
+                typed.push_back(std::to_string(value));
+            }
+        } else if (!replayed.empty()) {
+            if constexpr (std::is_same_v<T, std::string>) {
+                value = replayed.front();
+            } else {
+                std::istringstream(replayed.front()) >> value;
+            }
+            replayed = replayed.subspan(1);
+        }
+        return value;
+    }
+
+    [[nodiscard]] const std::vector<std::string>& answers() const {
+        return typed;
+    }
+};
+
+// Shows the roster a second after each command; the delay parks the task on a scheduler timer. The
+// display takes a shared turn of `turns`, so it never overlaps a menu command holding its own.
+template <typename Container>
+Task<void> threadTest(const Container& container, AsyncSharedMutex& turns) {
+    LogLine() << "Started a task for displaying all animals.";
+    co_await CoroutineScheduler::instance().sleepFor(std::chrono::seconds(1));
+    [[maybe_unused]] const auto turn = co_await turns.lock(true);
+    if constexpr (requires { container.displayAllAsync(); }) {
+        co_await container.displayAllAsync();
+    } else {
+        container.displayAll();
+    }
+}
+
+// Lets ordinary code queue for a turn through blockOn().
+inline Task<AsyncSharedMutex::Turn> takeTurn(AsyncSharedMutex& turns, bool shared) {
+    co_return co_await turns.lock(shared);
+}
+
+// Optional menu options, present when the container has what they drive.
+template <typename Container>
+struct MenuFeatures {
+    static constexpr bool partitioned = requires(Container& container) { container.addWorker(std::string()); };
+    static constexpr bool snapshots = requires(Container& container) {
+        container.forkSnapshot(true, [](std::size_t, const std::vector<bool>&, auto) {});
+    };
+    static constexpr bool checkpoints = requires(Container& container) { container.checkpoint(); };
+};
+
+// Loads a snapshot chain into the container, in bulk when the container supports it.
+template <typename Container>
+void restoreSnapshot(Container& container, const std::string& path) {
+    std::vector<std::shared_ptr<Animal>> restored;
+    const SnapshotChainStats stats = loadSnapshotChain(path, [&restored](AnimalKind kind, std::string_view name) {
+        restored.push_back(animalKinds[static_cast<std::size_t>(kind)].create(std::string(name)));
+    });
+    if constexpr (requires { container.addAnimals(restored); }) {
+        container.addAnimals(restored);
+    } else {
+        for (const auto& animal : restored) {
+            container.addAnimal(animal);
+        }
+    }
+    LogLine() << "Restored " << stats.animals << " animals from " << stats.files << " snapshot files ("
+              << stats.pages << " pages, " << stats.bytes << " bytes)";
+}
+
+// Runs one menu option against the container, taking its arguments from `arguments`. Returns false
+// once the option is Exit.
+template <typename Container>
+bool runCommand(Container& container, int choice, CommandArguments& arguments, AnimalNotifier& notifier,
+                BackgroundSnapshot& snapshot) {
+    using Features = MenuFeatures<Container>;
+    switch (choice) {
+    case 1: {
+        const auto type = arguments.next("Enter animal type (Dog/Cat): ");
+        const auto name = arguments.next("Enter animal name: ");
+
+        try {
+            auto animal = AnimalFactory::createAnimal(type, name);
+            container.addAnimal(animal);
+        } catch (const std::invalid_argument& e) {
+            LogLine() << e.what();
+        }
+        break;
+    }
+    case 2:
+        container.displayAll();
+        break;
+    case 3: {
+        const auto type = arguments.next("Enter animal type to remove (Dog/Cat): ");
+        if (kindFromType(type)) {
+            container.removeAnimal(type);
+        } else {
+            LogLine() << "Unknown animal type";
+        }
+        break;
+    }
+    case 4:
+        container.displayAnimalInfo(arguments.next("Enter animal type to get info: "));
+        break;
+    case 5:
+        container.sortAnimals();
+        LogLine() << "Animals sorted.";
+        break;
+    case 6:
+        AnimalContainerBase::showInstanceCount();
+        break;
+    case 7:
+        return false;
+    case 8: {
+        const auto name = arguments.next("Enter animal name to find: ");
+        if (const auto animal = container.findAnimal(name)) {
+            animal->info();
+        } else {
+            LogLine() << "No animal named " << name;
+        }
+        break;
+    }
+    case 9:
+        showMetrics();
+        container.reportMetrics();
+        notifier.reportMetrics();
+        if constexpr (Features::snapshots) {
+            snapshot.reportMetrics();
+        }
+        break;
+    case 10: {
+        const auto type = arguments.next("Enter animal type (Dog/Cat/*): ");
+        const auto prefix = arguments.next("Enter name prefix (* for any): ");
+        const auto limit = arguments.next<std::int64_t>("Enter maximum results (0 for all): ");
+        const auto kind = kindFromType(type);
+        if (!kind && type != "*") {
+            LogLine() << "Unknown animal type";
+            break;
+        }
+        if (limit < 0) {
+            LogLine() << "Maximum results cannot be negative";
+            break;
+        }
+        auto query = container.query();
+        if (kind) {
+            query.where(animalKind == *kind);
+        }
+        if (prefix != "*") {
+            query.where(animalName.startsWith(prefix));
+        }
+        if (limit != 0) {
+            query.take(static_cast<std::size_t>(limit));
+        }
+        query.sortBy(QueryOrder::Name).display();
+        break;
+    }
+    case 11:
+        if constexpr (Features::partitioned) {
+            const auto path = arguments.next("Enter worker socket path: ");
+            try {
+                container.addWorker(path);
+                LogLine() << "Worker " << path << " joined, rebalancing in the background";
+            } catch (const std::runtime_error& e) {
+                LogLine() << e.what();
+            }
+        } else {
+            LogLine() << "Invalid option. Please try again.";
+        }
+        break;
+    case 12:
+        if constexpr (Features::snapshots) {
+            snapshot.start(container, arguments.next("Enter snapshot path: "));
+        } else {
+            LogLine() << "Invalid option. Please try again.";
+        }
+        break;
+    case 13:
+        if constexpr (Features::checkpoints) {
+            container.checkpoint();
+            LogLine() << "Checkpoint complete.";
+        } else {
+            LogLine() << "Invalid option. Please try again.";
+        }
+        break;
+    case 14: {
+        // Separate from option 3, so animals named "Dog" or "Cat" can be removed too.
+        const auto name = arguments.next("Enter animal name to remove: ");
+        LogLine() << "Removed " << container.removeAnimalByName(name) << " animal(s) named " << name;
+        break;
+    }
+    default:
+        LogLine() << "Invalid option. Please try again.";
+    }
+    return true;
+}
+
+// Observers mirror the container starting from an empty list, so a container that opens with animals
+// in it, such as a reopened mapped file or a router over running workers, is announced to them as one
+// batch of additions before any command runs. Returns how many animals were announced.
+template <typename Container>
+std::size_t announceContents(Container& container, AnimalNotifier& notifier) {
+    std::vector<AnimalChange> initial;
+    for (auto& animal : container.query().collect()) {
+        initial.push_back(AnimalAdded{static_cast<std::uint32_t>(initial.size()), std::move(animal)});
+    }
+    const std::size_t count = initial.size();
+    if (count != 0) {
+        notifier.publish(std::move(initial));
+    }
+    return count;
+}
+
+template <typename Container>
+void runMenu(Container& container, AnimalNotifier& notifier, std::chrono::microseconds compactBudget,
+             const std::string& restoreFrom = {}, CommandRecorder* recorder = nullptr) {
+    using Features = MenuFeatures<Container>;
+    BackgroundSnapshot snapshot;
+    container.trackChanges(true);
+    const std::size_t existing = announceContents(container, notifier);
+    if constexpr (Features::snapshots || Features::checkpoints) {
+        // Restored animals are recorded as additions, so observers see them as the first batch. A
+        // container that opened with animals, a mapped file above all, is already persistent, and
+        // restoring into it would append the chain again on every start.
+        if (!restoreFrom.empty() && existing != 0) {
+            LogLine() << "Not restoring " << restoreFrom << ": the container already holds " << existing
+                      << " animals";
+        } else if (!restoreFrom.empty()) {
+            try {
+                restoreSnapshot(container, restoreFrom);
+            } catch (const std::runtime_error& e) {
+                LogLine() << e.what();
+            }
+            notifier.publish(container.takeChanges());
+        }
+    }
+    // A command that fails, e.g. on a lost partition worker, is reported and the menu carries on.
+    const auto reportFailure = [](auto step) {
+        try {
+            step();
+        } catch (const std::runtime_error& e) {
+            LogLine() << e.what();
+        }
+    };
+    // The roster display runs in the background, so the menu is back as soon as a command is done. Each
+    // command holds an exclusive turn, which keeps a display from reading the container mid-command,
+    // and the group is waited for before the container can go away.
+    AsyncSharedMutex turns;
+    TaskGroup displays;
+    bool running = true;
+    while (running) {
+        menu(Features::partitioned, Features::snapshots, Features::checkpoints);
+        int choice;
+        if (!(std::cin >> choice)) {
+            break;
+        }
+        const auto turn = blockOn(takeTurn(turns, false));
+        const auto issued = recorder != nullptr ? recorder->elapsed() : std::chrono::microseconds(0);
+
+        CommandArguments arguments;
+        reportFailure([&] { running = runCommand(container, choice, arguments, notifier, snapshot); });
+        if (recorder != nullptr) {
+            recorder->record(choice, issued, arguments.answers());
+        }
+
+        notifier.publish(container.takeChanges());
+        snapshot.poll();
+        // Keeps observer output next to the command that caused it; a slow observer stalls the menu
+        // for at most this long and otherwise just falls behind on its own queue.
+        notifier.waitIdle(std::chrono::milliseconds(50));
+
+        if constexpr (!requires { requires Container::syncIsThreadSafe; }) {
+            reportFailure([&] { container.compactFor(compactBudget); });
+        }
+
+        if (running) {
+            displays.spawn(threadTest(container, turns));
+        }
+    }
+}
+
+// Per-command latency samples from a replay, reported as a distribution per menu option.
+class ReplayLatencies {
+private:
+    std::vector<std::pair<std::string, std::vector<std::chrono::nanoseconds>>> samples;
+
+    std::vector<std::chrono::nanoseconds>& of(std::string_view label) {
+        const auto it =
+            std::ranges::find(samples, label, [](const auto& entry) { return std::string_view(entry.first); });
+        if (it != samples.end()) {
+            return it->second;
+        }
+        return samples.emplace_back(std::string(label), std::vector<std::chrono::nanoseconds>()).second;
+    }
+
+public:
+    void add(std::string_view label, std::chrono::nanoseconds latency) {
+        of(label).push_back(latency);
+    }
+
+    void report() {
+        const auto micros = [](std::chrono::nanoseconds latency) {
+            return std::chrono::duration<double, std::micro>(latency).count();
+        };
+        LogLine() << std::left << std::setw(36) << "command" << std::right << std::setw(8) << "count"
+                  << std::setw(12) << "p50 us" << std::setw(12) << "p90 us" << std::setw(12) << "p99 us"
+                  << std::setw(12) << "max us" << std::setw(12) << "total ms";
+        for (auto& [label, latencies] : samples) {
+            std::ranges::sort(latencies);
+            // Nearest-rank percentile.
+            const auto at = [&latencies](std::size_t percentile) {
+                const std::size_t rank = (percentile * latencies.size() + 99) / 100;
+                return latencies[std::max<std::size_t>(rank, 1) - 1];
+            };
+            std::chrono::nanoseconds total{0};
+            for (const auto latency : latencies) {
+                total += latency;
+            }
+            LogLine() << std::left << std::setw(36) << label << std::right << std::setw(8) << latencies.size()
+                      << std::fixed << std::setprecision(1) << std::setw(12) << micros(at(50)) << std::setw(12)
+                      << micros(at(90)) << std::setw(12) << micros(at(99)) << std::setw(12)
+                      << micros(latencies.back()) << std::setw(12) << std::setprecision(2)
+                      << micros(total) / 1000;
+        }
+    }
+};
+
+// Re-runs a recorded trace through the same command code as the menu, either at the recorded pacing
+// or back to back, and reports each command's latency. Compaction runs between commands as it does in
+// the menu and is reported on its own line; the menu's one-second display thread is left out, and
+// nothing is tracked for observers.
+template <typename Container>
+void replayTrace(Container& container, const std::vector<TracedCommand>& commands, bool recordedPacing,
+                 std::chrono::microseconds compactBudget) {
+    using Clock = std::chrono::steady_clock;
+    AnimalNotifier notifier;
+    BackgroundSnapshot snapshot;
+    ReplayLatencies latencies;
+    std::size_t late = 0;
+    Clock::duration maxLag{0};
+    std::size_t replayed = 0;
+    const auto started = Clock::now();
+    for (const TracedCommand& command : commands) {
+        if (recordedPacing) {
+            const auto due = started + command.offset;
+            const auto now = Clock::now();
+            if (now < due) {
+                std::this_thread::sleep_until(due);
+            } else if (now - due > std::chrono::milliseconds(1)) {
+                ++late;
+                maxLag = std::max(maxLag, now - due);
+            }
+        }
+        CommandArguments arguments(command.arguments);
+        const auto begin = Clock::now();
+        const bool running = runCommand(container, command.choice, arguments, notifier, snapshot);
+        latencies.add(menuOption(command.choice), Clock::now() - begin);
+        ++replayed;
+        snapshot.poll();
+        if (!running) {
+            break;
+        }
+        if constexpr (!requires { requires Container::syncIsThreadSafe; }) {
+            const auto compacting = Clock::now();
+            container.compactFor(compactBudget);
+            latencies.add("(compaction between commands)", Clock::now() - compacting);
+        }
+    }
+    blockOn(snapshot.completion());
+    const auto wall = std::chrono::duration<double, std::milli>(Clock::now() - started).count();
+    const auto span = commands.empty() ? 0.0
+                                       : std::chrono::duration<double, std::milli>(commands.back().offset).count();
+    LogLine() << "Replayed " << replayed << " of " << commands.size() << " commands in " << std::fixed
+              << std::setprecision(2) << wall << " ms (recorded span " << span << " ms, "
+              << (recordedPacing ? "recorded pacing" : "max speed") << ")";
+    if (recordedPacing && late != 0) {
+        LogLine() << late << " commands started late, by up to "
+                  << std::chrono::duration<double, std::milli>(maxLag).count() << " ms";
+    }
+    latencies.report();
+}
+
+// Read-only menu served by a replica process.
+void runReplicaMenu(const ReplicaStore& replica) {
+    bool running = true;
+    while (running) {
+        LogSink::instance().write("1. Display All Animals\n"
+                                  "2. Display Animal Info\n"
+                                  "3. Find Animal by Name\n"
+                                  "4. Query Animals\n"
+                                  "5. Show Replication Status\n"
+                                  "6. Exit\n");
+        LogSink::instance().flush();
+        int choice;
+        if (!(std::cin >> choice)) {
+            break;
+        }
+        if (choice >= 1 && choice <= 4 && !replica.fresh()) {
+            std::string ignored;
+            std::getline(std::cin, ignored);
+            const auto staleness = replica.staleness();
+            LogLine() << "Replica is stale ("
+                      << (staleness == std::chrono::milliseconds::max() ? std::string("never synced")
+                                                                       : std::to_string(staleness.count()) + " ms")
+                      << ", bound " << replica.stalenessBound().count() << " ms); read refused";
+            continue;
+        }
+
+        switch (choice) {
+        case 1:
+            replica.query().display();
+            break;
+        case 2: {
+            std::string type;
+            prompt("Enter animal type to get info: ");
+            std::cin >> type;
+            if (const auto kind = kindFromType(type)) {
+                std::string out = replica.renderInfo(*kind);
+                if (!out.empty()) {
+                    LogSink::instance().write(std::move(out));
+                }
+            }
+            break;
+        }
+        case 3: {
+            std::string name;
+            prompt("Enter animal name to find: ");
+            std::cin >> name;
+            const auto found = replica.query().where(animalName == name).take(1).collect();
+            if (found.empty()) {
+                LogLine() << "No animal named " << name;
+            } else {
+                found.front()->info();
+            }
+            break;
+        }
+        case 4: {
+            std::string type, prefix;
+            std::int64_t limit = 0;
+            prompt("Enter animal type (Dog/Cat/*): ");
+            std::cin >> type;
+            prompt("Enter name prefix (* for any): ");
+            std::cin >> prefix;
+            prompt("Enter maximum results (0 for all): ");
+            std::cin >> limit;
+            const auto kind = kindFromType(type);
+            if (!kind && type != "*") {
+                LogLine() << "Unknown animal type";
+                break;
+            }
+            if (limit < 0) {
+                LogLine() << "Maximum results cannot be negative";
+                break;
+            }
+            auto query = replica.query();
+            if (kind) {
+                query.where(animalKind == *kind);
+            }
+            if (prefix != "*") {
+                query.where(animalName.startsWith(prefix));
+            }
+            if (limit != 0) {
+                query.take(static_cast<std::size_t>(limit));
+            }
+            query.sortBy(QueryOrder::Name).display();
+            break;
+        }
+        case 5:
+            replica.reportMetrics();
+            break;
+        case 6:
+            running = false;
+            break;
+        default:
+            LogLine() << "Invalid option. Please try again.";
+        }
+    }
+}
+
+template <typename Container>
+void benchmarkContainer(const char* label, std::size_t count) {
+    using Clock = std::chrono::steady_clock;
+    const auto elapsed = [](Clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    };
+    constexpr std::size_t lookups = 1000;
+    constexpr std::size_t readers = 4;
+
+    std::vector<std::shared_ptr<Animal>> animals;
+    animals.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        const auto kind = static_cast<AnimalKind>(i % AnimalKindCount);
+        animals.push_back(animalKinds[static_cast<std::size_t>(kind)].create("animal" + std::to_string(i)));
+    }
+
+    Container container;
+    auto start = Clock::now();
+    container.reserve(count, count * 16);
+    for (const auto& animal : animals) {
+        container.addAnimal(animal);
+    }
+    const double add = elapsed(start);
+
+    start = Clock::now();
+    std::size_t bytes = container.renderDisplay().size();
+    const double renderCold = elapsed(start);
+    start = Clock::now();
+    bytes += container.renderDisplay().size();
+    const double renderWarm = elapsed(start);
+
+    std::size_t found = 0;
+    start = Clock::now();
+    for (std::size_t i = 0; i < lookups; ++i) {
+        found += container.findAnimal(animals[i * count / lookups]->getName()) != nullptr;
+    }
+    const double find = elapsed(start);
+
+    double parallelFind = -1;
+    if constexpr (requires { Container::syncIsThreadSafe; }) {
+        if constexpr (Container::syncIsThreadSafe) {
+            std::atomic<std::size_t> parallelFound{0};
+            start = Clock::now();
+            std::vector<std::thread> threads;
+            for (std::size_t t = 0; t < readers; ++t) {
+                threads.emplace_back([&] {
+                    for (std::size_t i = 0; i < lookups; ++i) {
+                        parallelFound += container.findAnimal(animals[i * count / lookups]->getName()) != nullptr;
+                    }
+                });
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+            parallelFind = elapsed(start);
+            found += parallelFound;
+        }
+    }
+
+    start = Clock::now();
+    for (std::size_t i = 0; i < lookups; ++i) {
+        container.removeAnimalByName(animals[(i * count / lookups + 1) % count]->getName());
+    }
+    const double removeByName = elapsed(start);
+
+    start = Clock::now();
+    container.sortAnimals();
+    const double sort = elapsed(start);
+    start = Clock::now();
+    container.removeAnimal("Cat");
+    const double remove = elapsed(start);
+
+    double compact = 0;
+    double longestSlice = 0;
+    for (bool more = true; more;) {
+        start = Clock::now();
+        more = container.compactFor(std::chrono::microseconds(500));
+        const double slice = elapsed(start);
+        compact += slice;
+        longestSlice = std::max(longestSlice, slice);
+    }
+
+    LogLine line;
+    line << std::left << std::setw(28) << label << std::right << std::fixed << std::setprecision(2)
+         << std::setw(10) << add << std::setw(10) << renderCold << std::setw(10) << renderWarm
+         << std::setw(10) << find;
+    if (parallelFind < 0) {
+        line << std::setw(10) << "-";
+    } else {
+        line << std::setw(10) << parallelFind;
+    }
+    line << std::setw(10) << removeByName << std::setw(10) << sort << std::setw(10) << remove << std::setw(10) << compact << std::setw(10)
+         << longestSlice << "   (" << bytes << " bytes, " << found << " found)";
+}
+
+// Single findAnimal calls against one lookupMany over the same keys, in random order so that
+// most probes miss the cache.
+template <typename Container>
+void benchmarkLookupMany(const char* label, std::size_t count) {
+    using Clock = std::chrono::steady_clock;
+    Container container;
+    std::vector<std::string> names;
+    names.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        names.push_back("animal" + std::to_string(i));
+        container.addAnimal(makeAnimal<Dog>(names.back()));
+    }
+    std::vector<std::string_view> keys(names.begin(), names.end());
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64(42));
+
+    auto start = Clock::now();
+    std::size_t single = 0;
+    for (std::string_view key : keys) {
+        single += container.findAnimal(key) != nullptr;
+    }
+    const double singleMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    start = Clock::now();
+    std::size_t batched = 0;
+    for (const auto& animal : container.lookupMany(keys)) {
+        batched += animal != nullptr;
+    }
+    const double batchedMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    LogLine() << std::left << std::setw(28) << label << std::right << std::fixed << std::setprecision(2)
+              << std::setw(12) << singleMs << std::setw(12) << batchedMs << "   (" << single << "/" << batched
+              << " found)";
+}
+
+// Many scans in flight at once: as coroutines they share the scheduler's workers, against one thread
+// per scan. Every scan must see the whole container.
+template <typename Container>
+void benchmarkAsyncScans(const char* label, std::size_t count, std::size_t scans) {
+    static_assert(Container::syncIsThreadSafe, "the thread-per-scan baseline needs a thread-safe SyncPolicy");
+    using Clock = std::chrono::steady_clock;
+    Container container;
+    for (std::size_t i = 0; i < count; ++i) {
+        container.addAnimal(makeAnimal<Dog>("animal" + std::to_string(i)));
+    }
+    std::atomic<std::size_t> visited{0};
+    const auto countVisited = [&visited](std::size_t seen) { visited.fetch_add(seen, std::memory_order_relaxed); };
+
+    auto start = Clock::now();
+    std::vector<Task<void>> tasks;
+    tasks.reserve(scans);
+    for (std::size_t i = 0; i < scans; ++i) {
+        tasks.push_back([](const Container& container, auto countVisited) -> Task<void> {
+            countVisited(co_await container.scanAsync([](AnimalKind, std::string_view) {}));
+        }(container, countVisited));
+    }
+    blockOn(whenAll(std::move(tasks)));
+    const double coroutineMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    const bool coroutinesComplete = visited.exchange(0) == count * scans;
+
+    start = Clock::now();
+    std::vector<std::thread> threads;
+    threads.reserve(scans);
+    for (std::size_t i = 0; i < scans; ++i) {
+        threads.emplace_back([&container, &countVisited] {
+            std::size_t seen = 0;
+            container.executeQuery(QuerySpec{}, [&seen](AnimalKind, std::string_view) { ++seen; });
+            countVisited(seen);
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    const double threadMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    LogLine() << std::left << std::setw(28) << label << std::right << std::fixed << std::setprecision(2)
+              << std::setw(12) << coroutineMs << std::setw(12) << threadMs
+              << (coroutinesComplete && visited.load() == count * scans ? "" : "   (incomplete scans)");
+}
+
+// Every thread creates a batch, then destroys the batch its neighbour created, so half the
+// frees in each round are cross-thread.
+template <typename Make>
+double benchmarkAnimalChurn(std::size_t count, std::size_t threadCount, Make make) {
+    using Clock = std::chrono::steady_clock;
+    constexpr std::size_t rounds = 8;
+    const std::size_t perThread = count / threadCount / rounds;
+    std::vector<std::vector<std::shared_ptr<Animal>>> batches(threadCount);
+    std::atomic<std::size_t> arrived{0};
+    const auto barrier = [&](std::size_t generation) {
+        arrived.fetch_add(1);
+        while (arrived.load() < generation * threadCount) {
+            std::this_thread::yield();
+        }
+    };
+
+    const auto start = Clock::now();
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < threadCount; ++t) {
+        threads.emplace_back([&, t] {
+            std::size_t generation = 0;
+            for (std::size_t round = 0; round < rounds; ++round) {
+                for (std::size_t i = 0; i < perThread; ++i) {
+                    batches[t].push_back(make("animal"));
+                }
+                barrier(++generation);
+                batches[(t + 1) % threadCount].clear();
+                barrier(++generation);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// Prints the events another process publishes with --event-bus until that process exits.
+int consumeEvents(const std::string& name) {
+    static constexpr std::array<const char*, 4> typeNames{"?", "Added", "Removed", "Reordered"};
+    SharedEventBusReader reader(name);
+    LogLine() << "Consuming events from " << name;
+    std::size_t idle = 0;
+    while (!reader.finished()) {
+        const std::size_t read = reader.poll([](const AnimalEventRecord& record) {
+            LogLine line;
+            line << "Event batch " << record.batch << ": " << typeNames[static_cast<std::size_t>(record.type) & 3];
+            if (record.type == AnimalEventType::Added) {
+                line << " " << animalKinds[record.kind % AnimalKindCount].type << " " << record.nameView() << " at "
+                     << record.first;
+            } else {
+                line << " " << record.count << " from " << record.first;
+            }
+        });
+        // Spin briefly for bursts, then back off so an idle consumer costs nothing.
+        if (read != 0) {
+            idle = 0;
+        } else if (++idle < 64) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    LogLine() << "Event bus closed, " << reader.lost() << " events lost";
+    return 0;
+}
+
+// Prints a published view from another process: a scan for the per-kind counts and the listing.
+int reportSharedView(const std::string& name) {
+    const SharedViewReader reader(name);
+    struct Report {
+        std::uint64_t epoch;
+        std::array<std::size_t, AnimalKindCount> perKind;
+        std::string listing;
+    };
+    Report report = reader.read([](const SharedViewReader::Snapshot& view) {
+        Report result{view.epoch(), {}, {}};
+        for (std::size_t i = 0; i < view.size(); ++i) {
+            ++result.perKind[static_cast<std::size_t>(view.kind(i))];
+            appendDisplayRow(result.listing, view.kind(i), view.name(i));
+        }
+        return result;
+    });
+    LogLine() << "View " << name << " epoch " << report.epoch << ": " << report.perKind[0] + report.perKind[1]
+              << " animals (" << report.perKind[0] << " dogs, " << report.perKind[1] << " cats)"
+              << (reader.closed() ? ", publisher exited" : "");
+    if (!report.listing.empty()) {
+        LogSink::instance().write(std::move(report.listing));
+    }
+    return 0;
+}
+
+#if defined(__linux__)
+// One consumer thread drains the bus while the producer publishes batches of Added events.
+void benchmarkEventBus(std::size_t count) {
+    using Clock = std::chrono::steady_clock;
+    constexpr std::size_t batchSize = 64;
+    const std::string name = "/animal-bench-" + std::to_string(getpid());
+    const auto animal = makeAnimal<Dog>("animal");
+    std::vector<AnimalChange> batch;
+    for (std::size_t i = 0; i < batchSize; ++i) {
+        batch.emplace_back(AnimalAdded{static_cast<std::uint32_t>(i), animal});
+    }
+    const std::size_t total = count / batchSize * batchSize;
+    std::size_t received = 0;
+    std::uint64_t lost = 0;
+    double elapsed = 0;
+    {
+        SharedEventBus bus(name);
+        std::atomic<bool> ready{false};
+        std::thread consumer([&] {
+            SharedEventBusReader reader(name);
+            ready.store(true);
+            while (received + reader.lost() < total) {
+                received += reader.poll([](const AnimalEventRecord&) {});
+            }
+            lost = reader.lost();
+        });
+        while (!ready.load()) {
+            std::this_thread::yield();
+        }
+        const auto start = Clock::now();
+        for (std::size_t sent = 0; sent < total; sent += batchSize) {
+            bus.publish(batch);
+        }
+        consumer.join();
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    }
+    LogLine() << "Shared-memory event bus: " << total << " events in " << std::fixed << std::setprecision(2)
+              << elapsed * 1000 << " ms (" << static_cast<double>(total) / elapsed / 1e6 << " M events/s), "
+              << received << " received, " << lost << " lost";
+}
+#endif
+
+void runBenchmarks(std::size_t count) {
+    LogLine() << "Benchmarking " << count << " animals, times in ms";
+    LogLine() << std::left << std::setw(28) << "storage/index/sync" << std::right << std::setw(10) << "add"
+              << std::setw(10) << "render" << std::setw(10) << "cached" << std::setw(10) << "find"
+              << std::setw(10) << "find x4" << std::setw(10) << "del name" << std::setw(10) << "sort"
+              << std::setw(10) << "remove"
+              << std::setw(10) << "compact" << std::setw(10) << "slice";
+    benchmarkContainer<AnimalContainer>("pointer/none/null", count);
+    benchmarkContainer<BasicAnimalContainer<PointerStorage, HashNameIndex, NullSync>>("pointer/hash/null", count);
+    benchmarkContainer<BasicAnimalContainer<ColumnStorage, NoNameIndex, NullSync>>("column/none/null", count);
+    benchmarkContainer<ColumnarAnimalContainer>("column/hash/null", count);
+    benchmarkContainer<BasicAnimalContainer<ColumnStorage, HashNameIndex, SharedMutexSync>>(
+        "column/hash/shared-mutex", count);
+    benchmarkContainer<ConcurrentAnimalContainer>("column/hash/sharded", count);
+    StorageMemory::reportMetrics();
+
+    LogLine() << "Looking up " << count << " shuffled names, times in ms";
+    LogLine() << std::left << std::setw(28) << "storage/index/sync" << std::right << std::setw(12) << "find"
+              << std::setw(12) << "lookupMany";
+    benchmarkLookupMany<BasicAnimalContainer<PointerStorage, HashNameIndex, NullSync>>("pointer/hash/null", count);
+    benchmarkLookupMany<ColumnarAnimalContainer>("column/hash/null", count);
+
+    constexpr std::size_t scans = 1000;
+    LogLine() << scans << " concurrent scans of " << count / 100 << " animals, times in ms";
+    LogLine() << std::left << std::setw(28) << "storage/index/sync" << std::right << std::setw(12) << "coroutines"
+              << std::setw(12) << "threads";
+    benchmarkAsyncScans<BasicAnimalContainer<ColumnStorage, HashNameIndex, SharedMutexSync>>(
+        "column/hash/shared-mutex", count / 100, scans);
+    benchmarkAsyncScans<ConcurrentAnimalContainer>("column/hash/sharded", count / 100, scans);
+
+    LogLine() << "Cross-thread create/destroy churn of " << count << " animals, times in ms";
+    LogLine() << std::left << std::setw(28) << "threads" << std::right << std::setw(12) << "make_shared"
+              << std::setw(12) << "pool";
+    for (std::size_t threads = 1; threads <= std::max<std::size_t>(4, std::thread::hardware_concurrency());
+         threads *= 2) {
+        const double heap = benchmarkAnimalChurn(count, threads, [](std::string name) -> std::shared_ptr<Animal> {
+            return std::make_shared<Dog>(std::move(name));
+        });
+        const double pool = benchmarkAnimalChurn(count, threads, [](std::string name) {
+            return makeAnimal<Dog>(std::move(name));
+        });
+        LogLine() << std::left << std::setw(28) << threads << std::right << std::fixed << std::setprecision(2)
+                  << std::setw(12) << heap << std::setw(12) << pool;
+    }
+    AnimalBlockPool::reportMetrics();
+
+#if defined(__linux__)
+    try {
+        benchmarkEventBus(count * 10);
+    } catch (const std::runtime_error& e) {
+        LogLine() << e.what();
+    }
+#endif
+}
+
+// Checks run by --self-test, for behaviour the menu alone cannot show; each failed check is logged and
+// makes the run exit non-zero.
+class SelfTest {
+private:
+    std::size_t checks = 0;
+    std::size_t failures = 0;
+
+public:
+    void check(bool ok, std::string_view what) {
+        ++checks;
+        if (!ok) {
+            ++failures;
+            LogLine() << "FAILED: " << what;
+        }
+    }
+
+    [[nodiscard]] int finish() const {
+        LogLine() << "Self test: " << checks - failures << "/" << checks << " checks passed";
+        return failures == 0 ? 0 : 1;
+    }
+};
+
+// Exposes the roster mirror, so a test can compare it with the container it follows.
+class RosterProbe : public AnimalRosterObserver {
+public:
+    [[nodiscard]] std::vector<std::string> names() const {
+        std::vector<std::string> out;
+        for (const Entry& entry : roster) {
+            out.push_back(entry.name);
+        }
+        return out;
+    }
+};
+
+template <typename Container>
+std::vector<std::string> namesOf(const Container& container) {
+    std::vector<std::string> out;
+    for (const auto& animal : container.query().collect()) {
+        out.push_back(animal->getName());
+    }
+    return out;
+}
+
+// Scans in small chunks yield between them, so they are in flight while sortAsync queues up; every
+// scan must still see the roster wholly before or wholly after the sort.
+template <typename Container>
+void selfTestAsyncInterleaving(SelfTest& test, std::string_view label) {
+    Container container;
+    for (int i = 999; i >= 0; --i) {
+        if (i % 3 == 0) {
+            container.addAnimal(makeAnimal<Cat>("cat" + std::to_string(i)));
+        } else {
+            container.addAnimal(makeAnimal<Dog>("dog" + std::to_string(i)));
+        }
+    }
+    const std::vector<std::string> before = namesOf(container);
+    std::array<std::vector<std::string>, 4> scans;
+    std::vector<Task<void>> tasks;
+    for (std::size_t i = 0; i < scans.size(); ++i) {
+        if (i == 1) {
+            tasks.push_back(container.sortAsync());
+        }
+        tasks.push_back([](const Container& container, std::vector<std::string>& seen) -> Task<void> {
+            co_await container.scanAsync([&seen](AnimalKind, std::string_view name) { seen.emplace_back(name); }, 16);
+        }(container, scans[i]));
+    }
+    blockOn(whenAll(std::move(tasks)));
+    const std::vector<std::string> after = namesOf(container);
+    test.check(after != before && std::ranges::is_permutation(after, before),
+               std::string(label) + ": sortAsync reorders the roster");
+    for (const auto& seen : scans) {
+        test.check(seen == before || seen == after, std::string(label) + ": scanAsync sees no half-sorted roster");
+    }
+}
+
+// Change batches survive an encode/decode round trip, and frames that lie about their counts or end
+// early are refused rather than allocated or applied.
+void selfTestWireFrames(SelfTest& test) {
+    const std::vector<AnimalChange> batch = {AnimalAdded{0, makeAnimal<Dog>("rex")},
+                                             AnimalAdded{1, makeAnimal<Cat>("tom")},
+                                             AnimalsReordered{{{1, 1}, {0, 1}}},
+                                             AnimalsRemoved{{0}}};
+    ReplicationEncoder encoder;
+    encoder.putChanges(batch);
+    const std::string payload = std::move(encoder).payload();
+    try {
+        WireDecoder decoder(payload);
+        const std::vector<AnimalChange> decoded = decoder.getChanges();
+        test.check(decoder.done() && decoded.size() == batch.size(), "decoder reads the whole change batch");
+        test.check(AnimalRosterObserver::fits(decoded, 0), "decoded batch fits an empty roster");
+        RosterProbe roster;
+        roster.changed(decoded);
+        test.check(roster.names() == std::vector<std::string>{"rex"}, "decoded batch replays to the same roster");
+    } catch (const std::runtime_error& e) {
+        test.check(false, e.what());
+    }
+
+    const auto refused = [](std::string_view bytes) {
+        try {
+            WireDecoder(bytes).getChanges();
+        } catch (const std::runtime_error&) {
+            return true;
+        }
+        return false;
+    };
+    test.check(refused(std::string_view(payload).substr(0, payload.size() - 1)), "decoder refuses a truncated frame");
+    std::string oversized = payload;
+    const std::uint32_t count = std::numeric_limits<std::uint32_t>::max();
+    std::memcpy(oversized.data(), &count, sizeof(count));
+    test.check(refused(oversized), "decoder refuses a count larger than the frame");
+    std::string unknown = payload;
+    unknown[sizeof(std::uint32_t)] = 7;
+    test.check(refused(unknown), "decoder refuses an unknown change tag");
+
+    test.check(!AnimalRosterObserver::fits(batch, 5) && !AnimalRosterObserver::fits(batch, 1),
+               "batches that do not match the roster size are refused");
+    const std::vector<AnimalChange> stray = {AnimalsRemoved{{3}}};
+    test.check(!AnimalRosterObserver::fits(stray, 2), "removals past the roster are refused");
+}
+
+#if defined(__linux__)
+// A reopened mapped file already holds animals; observers must learn about them before the first
+// command, or positions in later Added and Reordered events point past their mirror.
+void selfTestMappedReopen(SelfTest& test) {
+    const std::string path = "/tmp/animal-self-test-" + std::to_string(getpid()) + ".map";
+    unlink(path.c_str());
+    {
+        MappedAnimalContainer container(path);
+        container.addAnimal(makeAnimal<Dog>("rex"));
+        container.addAnimal(makeAnimal<Cat>("tom"));
+    }
+    {
+        MappedAnimalContainer container(path);
+        test.check(container.size() == 2, "reopened mapped file keeps its animals");
+        AnimalNotifier notifier;
+        const auto roster = std::make_shared<RosterProbe>();
+        notifier.addObserver(roster, {"roster", 1024, ObserverOverflow::Detach});
+        container.trackChanges(true);
+        announceContents(container, notifier);
+        container.addAnimal(makeAnimal<Dog>("ace"));
+        notifier.publish(container.takeChanges());
+        container.sortAnimals();
+        notifier.publish(container.takeChanges());
+        container.removeAnimalByName("tom");
+        notifier.publish(container.takeChanges());
+        test.check(notifier.waitIdle(std::chrono::seconds(5)), "roster observer drains");
+        test.check(roster->names() == namesOf(container), "roster mirrors a reopened mapped file after mutation");
+    }
+    unlink(path.c_str());
+}
+
+// Writes a base image and a delta from forked children and reads the chain back.
+void selfTestSnapshotChain(SelfTest& test) {
+    const std::string path = "/tmp/animal-self-test-" + std::to_string(getpid()) + ".img";
+    ColumnarAnimalContainer container;
+    for (int i = 0; i < 600; ++i) {
+        container.addAnimal(makeAnimal<Dog>("dog" + std::to_string(i)));
+    }
+    BackgroundSnapshot snapshot;
+    test.check(snapshot.start(container, path), "base snapshot starts");
+    snapshot.poll(true);
+    container.addAnimal(makeAnimal<Cat>("tom"));
+    test.check(snapshot.start(container, path), "delta snapshot starts");
+    snapshot.poll(true);
+    std::vector<std::string> restored;
+    try {
+        const SnapshotChainStats stats = loadSnapshotChain(
+            path, [&restored](AnimalKind, std::string_view name) { restored.emplace_back(name); });
+        test.check(stats.files == 2, "snapshot chain has a base and a delta");
+    } catch (const std::runtime_error& e) {
+        test.check(false, e.what());
+    }
+    test.check(restored == namesOf(container), "snapshot chain restores every animal");
+    unlink(path.c_str());
+    unlink(SnapshotFormat::filePath(path, 1).c_str());
+}
+
+// Starts a partition worker in a fresh process, so it has its own signal handlers and log.
+pid_t spawnPartitionWorker(const std::string& path) {
+    const pid_t child = fork();
+    if (child == 0) {
+        const int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        execl("/proc/self/exe", "animals", "--partition-worker", path.c_str(), static_cast<char*>(nullptr));
+        _exit(127);
+    }
+    return child;
+}
+
+// Adds a worker to a loaded two-worker ring and drains the rebalance; every animal must still be
+// listed exactly once, and the new worker must have taken some of them over.
+void selfTestPartitionMigration(SelfTest& test) {
+    const std::string base = "/tmp/animal-self-test-" + std::to_string(getpid()) + ".worker";
+    const std::vector<std::string> paths = {base + "0", base + "1", base + "2"};
+    std::vector<pid_t> children;
+    for (const std::string& path : paths) {
+        children.push_back(spawnPartitionWorker(path));
+    }
+    const auto connect = [](const std::vector<std::string>& workers) {
+        for (int attempt = 0;; ++attempt) {
+            try {
+                return std::make_unique<PartitionedAnimalContainer>(workers);
+            } catch (const std::runtime_error&) {
+                if (attempt == 100) {
+                    throw;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            }
+        }
+    };
+    try {
+        const auto container = connect({paths[0], paths[1]});
+        for (int i = 0; i < 500; ++i) {
+            container->addAnimal(makeAnimal<Dog>("dog" + std::to_string(i)));
+        }
+        std::vector<std::string> before = namesOf(*container);
+        container->addWorker(paths[2]);
+        while (container->compactFor(std::chrono::seconds(1))) {
+        }
+        std::vector<std::string> after = namesOf(*container);
+        std::ranges::sort(before);
+        std::ranges::sort(after);
+        test.check(before.size() == 500 && after == before, "migration to a new worker loses no animals");
+        test.check(!namesOf(*connect({paths[2]})).empty(), "new worker takes over part of the ring");
+    } catch (const std::runtime_error& e) {
+        test.check(false, e.what());
+    }
+    for (const pid_t child : children) {
+        kill(child, SIGTERM);
+        waitpid(child, nullptr, 0);
+    }
+    for (const std::string& path : paths) {
+        unlink(path.c_str());
+    }
+}
+#endif
+
+int runSelfTests() {
+    SelfTest test;
+    selfTestAsyncInterleaving<ColumnarAnimalContainer>(test, "columnar");
+    selfTestAsyncInterleaving<ConcurrentAnimalContainer>(test, "concurrent");
+    selfTestWireFrames(test);
+#if defined(__linux__)
+    selfTestMappedReopen(test);
+    selfTestSnapshotChain(test);
+    selfTestPartitionMigration(test);
+#endif
+    return test.finish();
+}
+
+// Parses a whole decimal command-line value; anything else, trailing text included, gives nullopt.
+template <typename T>
+std::optional<T> parseNumber(std::string_view text) {
+    T value{};
+    const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (error != std::errc() || end != text.data() + text.size()) {
+        return std::nullopt;
+    }
+    return value;
+}
+
+// Reports a malformed option value together with the option's usage; main returns the result.
+int usageError(std::string_view usage, std::string_view value) {
+    std::cerr << "Invalid value '" << value << "'. Usage: " << usage << std::endl;
+    return 1;
+}
+
+int main(int argc, char* argv[]) {
+    bool segregated = false;
+    bool columnar = false;
+    bool concurrent = false;
+    std::size_t benchCount = 0;
+    bool selfTest = false;
+    std::chrono::microseconds compactBudget(500);
+    std::string eventBus;
+    std::string consumeBus;
+    std::string sharedView;
+    std::string reportView;
+    std::string replicateTo;
+    std::string replicaOf;
+    std::chrono::milliseconds maxStaleness(1000);
+    std::string partitionWorker;
+    std::vector<std::string> partitionWorkers;
+    std::string restoreFrom;
+    std::string mappedPath;
+    std::string recordTo;
+    std::string replayFrom;
+    bool replayMaxSpeed = false;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--log-file" && i + 1 < argc) {
+            try {
+                LogSink::instance().openFile(argv[++i]);
+            } catch (const std::runtime_error& e) {
+                std::cerr << e.what() << std::endl;
+                return 1;
+            }
+        } else if (arg == "--log-block") {
+            LogSink::instance().setDropPolicy(LogSink::DropPolicy::Block);
+        } else if (arg == "--segregated") {
+            // Lists animals grouped by kind (cats, then dogs) instead of in insertion order.
+            segregated = true;
+        } else if (arg == "--columnar") {
+            columnar = true;
+        } else if (arg == "--concurrent") {
+            concurrent = true;
+        } else if (arg == "--hugetlb") {
+            StorageMemory::options().hugeTlb = true;
+        } else if (arg == "--thp") {
+            StorageMemory::options().transparent = true;
+        } else if (arg == "--prefault") {
+            StorageMemory::options().prefault = true;
+        } else if (arg == "--no-release") {
+            StorageMemory::options().releaseAfterCompaction = false;
+        } else if (arg == "--compact-budget-us" && i + 1 < argc) {
+            const auto budget = parseNumber<std::uint32_t>(argv[++i]);
+            if (!budget || *budget == 0) {
+                return usageError("--compact-budget-us <microseconds > 0>", argv[i]);
+            }
+            compactBudget = std::chrono::microseconds(*budget);
+        } else if (arg == "--event-bus" && i + 1 < argc) {
+            eventBus = argv[++i];
+        } else if (arg == "--consume-events" && i + 1 < argc) {
+            consumeBus = argv[++i];
+        } else if (arg == "--share-view" && i + 1 < argc) {
+            sharedView = argv[++i];
+        } else if (arg == "--view-report" && i + 1 < argc) {
+            reportView = argv[++i];
+        } else if (arg == "--replicate" && i + 1 < argc) {
+            replicateTo = argv[++i];
+        } else if (arg == "--replica" && i + 1 < argc) {
+            replicaOf = argv[++i];
+        } else if (arg == "--partition-worker" && i + 1 < argc) {
+            partitionWorker = argv[++i];
+        } else if (arg == "--partition-router" && i + 1 < argc) {
+            std::istringstream paths(argv[++i]);
+            for (std::string path; std::getline(paths, path, ',');) {
+                partitionWorkers.push_back(path);
+            }
+        } else if (arg == "--mapped" && i + 1 < argc) {
+            mappedPath = argv[++i];
+        } else if (arg == "--restore" && i + 1 < argc) {
+            restoreFrom = argv[++i];
+        } else if (arg == "--record" && i + 1 < argc) {
+            recordTo = argv[++i];
+        } else if (arg == "--replay" && i + 1 < argc) {
+            replayFrom = argv[++i];
+        } else if (arg == "--replay-max-speed") {
+            replayMaxSpeed = true;
+        } else if (arg == "--max-staleness-ms" && i + 1 < argc) {
+            const auto staleness = parseNumber<std::uint32_t>(argv[++i]);
+            if (!staleness || *staleness == 0) {
+                return usageError("--max-staleness-ms <milliseconds > 0>", argv[i]);
+            }
+            maxStaleness = std::chrono::milliseconds(*staleness);
+        } else if (arg == "--self-test") {
+            selfTest = true;
+        } else if (arg == "--bench") {
+            benchCount = 100000;
+            if (i + 1 < argc) {
+                const auto count = parseNumber<std::size_t>(argv[++i]);
+                if (!count || *count == 0) {
+                    return usageError("--bench [animals > 0]", argv[i]);
+                }
+                benchCount = *count;
+            }
+        }
+    }
+
+    if (benchCount != 0) {
+        runBenchmarks(benchCount);
+        return 0;
+    }
+
+    if (selfTest) {
+        return runSelfTests();
+    }
+
+#if defined(__linux__)
+    if (!partitionWorker.empty()) {
+        try {
+            return runPartitionWorker(partitionWorker);
+        } catch (const std::runtime_error& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+#endif
+
+    if (!replicaOf.empty()) {
+        try {
+            const ReplicaStore replica(replicaOf, maxStaleness);
+            runReplicaMenu(replica);
+            return 0;
+        } catch (const std::runtime_error& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    if (!consumeBus.empty() || !reportView.empty()) {
+        try {
+            return consumeBus.empty() ? reportSharedView(reportView) : consumeEvents(consumeBus);
+        } catch (const std::runtime_error& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    if (!replayFrom.empty()) {
+        try {
+            const std::vector<TracedCommand> commands = loadCommandTrace(replayFrom);
+            AnimalContainer container;
+            if (!restoreFrom.empty()) {
+                restoreSnapshot(container, restoreFrom);
+            }
+            replayTrace(container, commands, !replayMaxSpeed, compactBudget);
+            return 0;
+        } catch (const std::runtime_error& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    std::optional<CommandRecorder> recorder;
+    if (!recordTo.empty()) {
+        try {
+            recorder.emplace(recordTo);
+        } catch (const std::runtime_error& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+    CommandRecorder* const trace = recorder ? &*recorder : nullptr;
+
+    AnimalNotifier notifier;
+    AnimalDetailsObserver observer;
+
+    notifier.addObserver(std::make_shared<AnimalDetailsObserver>(observer), {"details"});
+    // The roster is only correct if it sees every event, so it detaches rather than skip batches.
+    notifier.addObserver(std::make_shared<AnimalRosterObserver>(), {"roster", 1024, ObserverOverflow::Detach});
+    if (!eventBus.empty() || !sharedView.empty() || !replicateTo.empty()) {
+        try {
+            if (!eventBus.empty()) {
+                notifier.addObserver(std::make_shared<SharedEventBusObserver>(eventBus), {"event-bus", 4096});
+            }
+            if (!sharedView.empty()) {
+                // The view mirrors the roster, so like it the view must not miss batches.
+                notifier.addObserver(std::make_shared<SharedViewPublisher>(sharedView, std::size_t{64} << 20),
+                                     {"shared-view", 1024, ObserverOverflow::Detach});
+            }
+            if (!replicateTo.empty()) {
+                notifier.addObserver(std::make_shared<ReplicationPrimary>(replicateTo),
+                                     {"replication", 1024, ObserverOverflow::Detach});
+            }
+        } catch (const std::runtime_error& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    if (!partitionWorkers.empty()) {
+        try {
+            PartitionedAnimalContainer container(partitionWorkers);
+            runMenu(container, notifier, compactBudget, {}, trace);
+        } catch (const std::runtime_error& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    } else if (!mappedPath.empty()) {
+        try {
+            MappedAnimalContainer container(mappedPath);
+            runMenu(container, notifier, compactBudget, restoreFrom, trace);
+        } catch (const std::runtime_error& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    } else if (segregated) {
+        SegregatedAnimalContainer container;
+        runMenu(container, notifier, compactBudget, restoreFrom, trace);
+    } else if (columnar) {
+        ColumnarAnimalContainer container;
+        runMenu(container, notifier, compactBudget, restoreFrom, trace);
+    } else if (concurrent) {
+        ConcurrentAnimalContainer container;
+        BackgroundCompactor<ConcurrentAnimalContainer> compactor(container, compactBudget);
+        runMenu(container, notifier, compactBudget, restoreFrom, trace);
+    } else {
+        AnimalContainer container;
+        runMenu(container, notifier, compactBudget, restoreFrom, trace);
     }
 
     return 0; // No need for explicit return; C++ will return 0 implicitly.